@@ -0,0 +1,263 @@
+#include "cache.h"
+#include "image.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <stdexcept>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <vector>
+
+#include <dirent.h>
+
+static constexpr uint64_t PRIME1 = 0x9E3779B185EBCA87ull;
+static constexpr uint64_t PRIME2 = 0xC2B2AE3D27D4EB4Full;
+static constexpr uint64_t PRIME3 = 0x165667B19E3779F9ull;
+static constexpr uint64_t PRIME4 = 0x85EBCA77C2B2AE63ull;
+static constexpr uint64_t PRIME5 = 0x27D4EB2F165667C5ull;
+static constexpr size_t FILE_CHUNK_SIZE = 1 << 20;
+static constexpr const char *ENTRY_SUFFIX = ".out";
+
+static inline uint64_t rotl(uint64_t value, int bits) noexcept {
+    return (value << bits) | (value >> (64 - bits));
+}
+
+static inline uint64_t read64(const unsigned char *p) noexcept {
+    uint64_t value;
+    memcpy(&value, p, sizeof(value));
+    return value;
+}
+
+static inline uint64_t mixRound(uint64_t accumulator, uint64_t input) noexcept {
+    return rotl(accumulator + input * PRIME2, 31) * PRIME1;
+}
+
+// Four independent lanes over 32-byte stripes, in the spirit of xxHash64
+uint64_t hashBytes(const void *data, size_t size, uint64_t seed) noexcept {
+    const unsigned char *p = static_cast<const unsigned char *>(data);
+    const unsigned char *end = p + size;
+    uint64_t hash;
+
+    if (size >= 32) {
+        uint64_t v1 = seed + PRIME1 + PRIME2, v2 = seed + PRIME2, v3 = seed, v4 = seed - PRIME1;
+        for (; p + 32 <= end; p += 32) {
+            v1 = mixRound(v1, read64(p));
+            v2 = mixRound(v2, read64(p + 8));
+            v3 = mixRound(v3, read64(p + 16));
+            v4 = mixRound(v4, read64(p + 24));
+        }
+        hash = rotl(v1, 1) + rotl(v2, 7) + rotl(v3, 12) + rotl(v4, 18);
+        for (uint64_t v : {v1, v2, v3, v4}) {
+            hash = (hash ^ mixRound(0, v)) * PRIME1 + PRIME4;
+        }
+    } else {
+        hash = seed + PRIME5;
+    }
+    hash += size;
+
+    for (; p + 8 <= end; p += 8) {
+        hash = rotl(hash ^ mixRound(0, read64(p)), 27) * PRIME1 + PRIME4;
+    }
+    for (; p < end; ++p) {
+        hash = rotl(hash ^ (*p * PRIME5), 11) * PRIME1;
+    }
+
+    hash ^= hash >> 33;
+    hash *= PRIME2;
+    hash ^= hash >> 29;
+    hash *= PRIME3;
+    hash ^= hash >> 32;
+    return hash;
+}
+
+uint64_t hashFile(const std::string &filename) {
+    FILE *file = fopen(filename.c_str(), "rb");
+    if (!file) throw std::runtime_error("Couldn't open file \"" + filename + "\"");
+    std::vector<unsigned char> chunk(FILE_CHUNK_SIZE);
+    uint64_t hash = 0;
+    size_t read;
+    while ((read = fread(chunk.data(), 1, chunk.size(), file)) > 0) {
+        hash = hashBytes(chunk.data(), read, hash);
+    }
+    fclose(file);
+    return hash;
+}
+
+std::string hashToHex(uint64_t hash) {
+    char buffer[17];
+    snprintf(buffer, sizeof(buffer), "%016llx", static_cast<unsigned long long>(hash));
+    return buffer;
+}
+
+std::string userCacheDirectory() {
+    std::string base;
+    if (const char *xdg = getenv("XDG_CACHE_HOME")) {
+        base = xdg;
+    } else if (const char *home = getenv("HOME")) {
+        base = std::string(home) + "/.cache";
+    } else {
+        base = "/tmp";
+    }
+    mkdir(base.c_str(), 0755);
+    std::string directory = base + "/imageTool";
+    if (mkdir(directory.c_str(), 0755) != 0 && errno != EEXIST) {
+        throw std::runtime_error("Couldn't create directory \"" + directory + "\"");
+    }
+    return directory;
+}
+
+ResultCache::ResultCache(const std::string &directory, uint64_t max_bytes)
+    : directory(directory), max_bytes(max_bytes) {
+    if (mkdir(directory.c_str(), 0755) != 0 && errno != EEXIST) {
+        throw std::runtime_error("Couldn't create cache directory \"" + directory + "\"");
+    }
+}
+
+std::string ResultCache::directoryFromEnvironment() {
+    const char *directory = getenv("IMAGETOOL_CACHE_DIR");
+    return directory ? directory : "";
+}
+
+std::string ResultCache::entryPath(const std::string &key) const {
+    return directory + "/" + hashToHex(hashBytes(key.data(), key.size())) + ENTRY_SUFFIX;
+}
+
+bool ResultCache::fetch(const std::string &key, const std::string &output_filename) {
+    std::string path = entryPath(key);
+    FILE *entry = fopen(path.c_str(), "rb");
+    if (!entry) {
+        updateStats(0, 1, 0);
+        return false;
+    }
+    FILE *output;
+    try {
+        output = openImageFile(output_filename, "wb");
+    } catch (const std::exception &e) {
+        fclose(entry);
+        throw;
+    }
+    std::vector<unsigned char> chunk(FILE_CHUNK_SIZE);
+    size_t read;
+    bool ok = true;
+    while (ok && (read = fread(chunk.data(), 1, chunk.size(), entry)) > 0) {
+        ok = fwrite(chunk.data(), 1, read, output) == read;
+    }
+    fclose(entry);
+    closeImageFile(output);
+    if (!ok) throw std::runtime_error("Couldn't write to file");
+    // Refresh the modification time, it is the recency used for eviction
+    utimensat(AT_FDCWD, path.c_str(), nullptr, 0);
+    updateStats(1, 0, 0);
+    return true;
+}
+
+void ResultCache::store(const std::string &key, const std::string &result_filename) {
+    std::string path = entryPath(key);
+    std::string temporary = path + ".tmp." + std::to_string(getpid());
+
+    FILE *source = fopen(result_filename.c_str(), "rb");
+    if (!source) throw std::runtime_error("Couldn't open file \"" + result_filename + "\"");
+    FILE *target = fopen(temporary.c_str(), "wb");
+    if (!target) {
+        fclose(source);
+        throw std::runtime_error("Couldn't create cache entry \"" + temporary + "\"");
+    }
+    std::vector<unsigned char> chunk(FILE_CHUNK_SIZE);
+    size_t read;
+    bool ok = true;
+    while (ok && (read = fread(chunk.data(), 1, chunk.size(), source)) > 0) {
+        ok = fwrite(chunk.data(), 1, read, target) == read;
+    }
+    fclose(source);
+    ok = fclose(target) == 0 && ok;
+    // Readers only ever see complete entries, rename is atomic within the directory
+    if (!ok || rename(temporary.c_str(), path.c_str()) != 0) {
+        unlink(temporary.c_str());
+        throw std::runtime_error("Couldn't write cache entry \"" + path + "\"");
+    }
+    evict();
+}
+
+void ResultCache::evict() {
+    struct Entry {
+        std::string path;
+        uint64_t size;
+        timespec accessed;
+    };
+    std::vector<Entry> entries;
+    uint64_t total = 0;
+
+    DIR *dir = opendir(directory.c_str());
+    if (!dir) return;
+    while (dirent *item = readdir(dir)) {
+        std::string name = item->d_name;
+        size_t suffix_length = strlen(ENTRY_SUFFIX);
+        if (name.size() <= suffix_length ||
+            name.compare(name.size() - suffix_length, suffix_length, ENTRY_SUFFIX) != 0) {
+            continue;
+        }
+        std::string path = directory + "/" + name;
+        struct stat info;
+        if (stat(path.c_str(), &info) != 0) continue;
+        entries.push_back({path, static_cast<uint64_t>(info.st_size), info.st_mtim});
+        total += info.st_size;
+    }
+    closedir(dir);
+
+    if (total <= max_bytes) return;
+    std::sort(entries.begin(), entries.end(), [](const Entry &a, const Entry &b) {
+        if (a.accessed.tv_sec != b.accessed.tv_sec) return a.accessed.tv_sec < b.accessed.tv_sec;
+        return a.accessed.tv_nsec < b.accessed.tv_nsec;
+    });
+    uint64_t evicted = 0;
+    for (const Entry &entry : entries) {
+        if (total <= max_bytes) break;
+        if (unlink(entry.path.c_str()) == 0) {
+            total -= entry.size;
+            ++evicted;
+        }
+    }
+    updateStats(0, 0, evicted);
+}
+
+// Counters are shared by every process using the directory, updates hold an exclusive lock
+void ResultCache::updateStats(uint64_t hits, uint64_t misses, uint64_t evictions) {
+    std::string path = directory + "/stats";
+    int fd = open(path.c_str(), O_RDWR | O_CREAT, 0644);
+    if (fd < 0) return;
+    flock(fd, LOCK_EX);
+    CacheStats stats;
+    char buffer[128] = {0};
+    if (pread(fd, buffer, sizeof(buffer) - 1, 0) > 0) {
+        unsigned long long h = 0, m = 0, e = 0;
+        sscanf(buffer, "hits %llu misses %llu evictions %llu", &h, &m, &e);
+        stats = {h, m, e};
+    }
+    stats.hits += hits;
+    stats.misses += misses;
+    stats.evictions += evictions;
+    int length = snprintf(buffer, sizeof(buffer), "hits %llu misses %llu evictions %llu\n",
+                          static_cast<unsigned long long>(stats.hits),
+                          static_cast<unsigned long long>(stats.misses),
+                          static_cast<unsigned long long>(stats.evictions));
+    if (ftruncate(fd, 0) == 0) {
+        pwrite(fd, buffer, length, 0);
+    }
+    flock(fd, LOCK_UN);
+    close(fd);
+}
+
+CacheStats ResultCache::getStats() const {
+    CacheStats stats;
+    FILE *file = fopen((directory + "/stats").c_str(), "r");
+    if (!file) return stats;
+    unsigned long long h = 0, m = 0, e = 0;
+    if (fscanf(file, "hits %llu misses %llu evictions %llu", &h, &m, &e) == 3) {
+        stats = {h, m, e};
+    }
+    fclose(file);
+    return stats;
+}
@@ -0,0 +1,46 @@
+#pragma once
+#include <cstdint>
+#include <string>
+
+// Fast non-cryptographic 64-bit hash, used to address cached results by content
+uint64_t hashBytes(const void *data, size_t size, uint64_t seed = 0) noexcept;
+uint64_t hashFile(const std::string &filename);
+std::string hashToHex(uint64_t hash);
+
+// Per-user directory for machine-local state, $XDG_CACHE_HOME/imageTool or
+// $HOME/.cache/imageTool, created on first use
+std::string userCacheDirectory();
+
+struct CacheStats {
+    uint64_t hits = 0;
+    uint64_t misses = 0;
+    uint64_t evictions = 0;
+};
+
+// On-disk cache of finished output files. Entries are addressed by a hash of the input
+// content and of every parameter that affects the result, written atomically through a
+// rename and evicted least-recently-used first once the cache grows past max_bytes.
+class ResultCache {
+  public:
+    static constexpr uint64_t DEFAULT_MAX_BYTES = 1ull << 30;
+
+    explicit ResultCache(const std::string &directory, uint64_t max_bytes = DEFAULT_MAX_BYTES);
+
+    // $IMAGETOOL_CACHE_DIR, empty when caching isn't configured
+    static std::string directoryFromEnvironment();
+
+    // Copies the cached result for key to output_filename ("-" for stdout), returns false
+    // on a miss without touching the output
+    bool fetch(const std::string &key, const std::string &output_filename);
+    // Adds a finished output file to the cache under key
+    void store(const std::string &key, const std::string &result_filename);
+    CacheStats getStats() const;
+
+  private:
+    std::string entryPath(const std::string &key) const;
+    void updateStats(uint64_t hits, uint64_t misses, uint64_t evictions);
+    void evict();
+
+    std::string directory;
+    uint64_t max_bytes;
+};
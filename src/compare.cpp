@@ -1,23 +1,60 @@
 #include "compare.h"
+#include "bmp.h"
+#include "convert.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstring>
+#include <fcntl.h>
+#include <random>
+#include <stdexcept>
+#include <thread>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <vector>
+
+// Sampled comparisons look at no fewer rows than this, the interval is meaningless below
+static constexpr int MIN_SAMPLED_ROWS = 16;
+// Two-sided 95% quantile of the normal distribution
+static constexpr double CONFIDENCE_Z = 1.96;
 
 int sqr(int a) noexcept { return a * a; }
 
-double MSE(Image image1, Image image2, bool ignore_dimensions = false) {
+static uint64_t rowSquaredError(const rgbPixel *row1, const rgbPixel *row2, int width) noexcept {
+    return squaredErrorBytes(reinterpret_cast<const unsigned char *>(row1),
+                             reinterpret_cast<const unsigned char *>(row2),
+                             static_cast<size_t>(width) * sizeof(rgbPixel));
+}
+
+double MSE(const Image &image1, const Image &image2, bool ignore_dimensions = false) {
     if (!ignore_dimensions &&
         (image1.getHeight() != image2.getHeight() || image1.getWidth() != image2.getWidth())) {
         throw std::invalid_argument("Images must be of the same size");
     }
     int width = std::min(image1.getWidth(), image2.getWidth());
     int height = std::min(image1.getHeight(), image2.getHeight());
-    int dif_sum = 0;
-    for (int y = 0; y < height; ++y) {
-        for (int x = 0; x < width; ++x) {
-            dif_sum += sqr(image1.getPixel(x, y).r - image2.getPixel(x, y).r) +
-                       sqr(image1.getPixel(x, y).g - image2.getPixel(x, y).g) +
-                       sqr(image1.getPixel(x, y).b - image2.getPixel(x, y).b);
+    uint64_t dif_sum = 0;
+    PixelLayout layout = image1.getLayout();
+    if (layout != PixelLayout::PACKED && image2.getLayout() == layout) {
+        // Sample rows are compared directly, the zero padding of BGRX adds nothing
+        int planes = layout == PixelLayout::PLANAR ? 3 : 1;
+        for (int i = 0; i < planes; ++i) {
+            SamplePlane plane1 = image1.getPlane(i), plane2 = image2.getPlane(i);
+            for (int y = 0; y < height; ++y) {
+                dif_sum += squaredErrorBytes(plane1.row(y), plane2.row(y),
+                                             static_cast<size_t>(width) * plane1.channels);
+            }
+        }
+    } else {
+        std::vector<rgbPixel> buffer1(width), buffer2(width);
+        for (int y = 0; y < height; ++y) {
+            dif_sum += rowSquaredError(image1.readPixels(0, y, width, buffer1.data()),
+                                       image2.readPixels(0, y, width, buffer2.data()), width);
         }
     }
-    return (double)dif_sum / (width * height * 3);
+    return (double)dif_sum / ((double)width * height * 3);
 }
 
 double psnr(double mse, int max_pixel_value) {
@@ -26,3 +63,281 @@ double psnr(double mse, int max_pixel_value) {
     }
     return 10 * log10(sqr(max_pixel_value) / mse);
 }
+
+namespace {
+
+class MappedFile {
+  public:
+    explicit MappedFile(const std::string &filename) {
+        int fd = open(filename.c_str(), O_RDONLY);
+        struct stat file_stat;
+        if (fd < 0 || fstat(fd, &file_stat) != 0) {
+            if (fd >= 0) close(fd);
+            throw std::runtime_error("Couldn't open file \"" + filename + "\"");
+        }
+        size = file_stat.st_size;
+        if (size > 0) data = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        close(fd);
+        if (data == MAP_FAILED) throw std::runtime_error("Couldn't map file \"" + filename + "\"");
+    }
+    ~MappedFile() {
+        if (data && data != MAP_FAILED) munmap(data, size);
+    }
+    MappedFile(const MappedFile &) = delete;
+    MappedFile &operator=(const MappedFile &) = delete;
+
+    const unsigned char *bytes() const noexcept { return static_cast<unsigned char *>(data); }
+    size_t getSize() const noexcept { return size; }
+    // Drops the pages of a range that won't be read again, they are reloaded if it is
+    void release(size_t offset, size_t length) const noexcept {
+        if (!data || data == MAP_FAILED) return;
+        size_t page = sysconf(_SC_PAGESIZE);
+        size_t start = offset / page * page;
+        madvise(static_cast<char *>(data) + start, std::min(offset + length, size) - start,
+                MADV_DONTNEED);
+    }
+
+  private:
+    void *data = nullptr;
+    size_t size = 0;
+};
+
+class BMPRowReader : public RowReader {
+  public:
+    explicit BMPRowReader(const std::string &filename) : file(filename) {
+        BMPHeader header;
+        BMPInfoHeader info;
+        if (file.getSize() < sizeof(header) + sizeof(info)) {
+            throw std::runtime_error("Failed to read BMP headers");
+        }
+        memcpy(&header, file.bytes(), sizeof(header));
+        memcpy(&info, file.bytes() + sizeof(header), sizeof(info));
+        if (header.signature != 0x4D42) throw std::runtime_error("Invalid BMP signature");
+        width = info.width;
+        height = info.height;
+        row_size = (static_cast<size_t>(width) * sizeof(rgbPixel) + 3) & ~size_t(3);
+        if (width <= 0 || height <= 0 || header.dataOffset > file.getSize() ||
+            (file.getSize() - header.dataOffset) / row_size < size_t(height)) {
+            throw std::runtime_error("Failed to read BMP pixel data");
+        }
+        pixels = file.bytes() + header.dataOffset;
+    }
+    int getWidth() const noexcept override { return width; }
+    int getHeight() const noexcept override { return height; }
+    void readRow(int y, rgbPixel *out) override {
+        memcpy(out, pixels + (height - 1 - y) * row_size, width * sizeof(rgbPixel));
+    }
+
+  private:
+    MappedFile file;
+    int width, height;
+    size_t row_size;
+    const unsigned char *pixels;
+};
+
+// First frame of a raw YUV file, rows are converted straight from the mapping
+class YUVRowReader : public RowReader {
+  public:
+    YUVRowReader(const std::string &filename, ImageFormat format, int width, int height)
+        : file(filename), format(format), width(width), height(height) {
+        if (width <= 0 || height <= 0) {
+            throw std::invalid_argument("YUV formats require width and height");
+        }
+        if (file.getSize() < yuvFrameSize(format, width, height)) {
+            throw std::runtime_error("Failed to read YUV data from file");
+        }
+    }
+    int getWidth() const noexcept override { return width; }
+    int getHeight() const noexcept override { return height; }
+    void readRow(int y, rgbPixel *out) override {
+        yuvRowToRgb(yuvRowAt(format, const_cast<unsigned char *>(file.bytes()), width, height, y),
+                    out, width);
+    }
+
+  private:
+    MappedFile file;
+    ImageFormat format;
+    int width, height;
+};
+
+class DecodedRowReader : public RowReader {
+  public:
+    DecodedRowReader(const std::string &filename, ImageFormat format, int width, int height)
+        : image(width, height) {
+        image.loadImageFromFile(filename, format);
+    }
+    int getWidth() const noexcept override { return image.getWidth(); }
+    int getHeight() const noexcept override { return image.getHeight(); }
+    void readRow(int y, rgbPixel *out) override {
+        std::copy_n(image.getRow(y), image.getWidth(), out);
+    }
+
+  private:
+    Image image;
+};
+
+void checkDimensions(RowReader &image1, RowReader &image2, bool ignore_dimensions) {
+    if (!ignore_dimensions && (image1.getHeight() != image2.getHeight() ||
+                               image1.getWidth() != image2.getWidth())) {
+        throw std::invalid_argument("Images must be of the same size");
+    }
+}
+
+} // namespace
+
+std::unique_ptr<RowReader> openRowReader(const std::string &filename, ImageFormat format,
+                                         int width, int height) {
+    if (filename != "-") {
+        if (format == ImageFormat::BMP) return std::make_unique<BMPRowReader>(filename);
+        if (isYUVFormat(format)) {
+            return std::make_unique<YUVRowReader>(filename, format, width, height);
+        }
+    }
+    return std::make_unique<DecodedRowReader>(filename, format, width, height);
+}
+
+MSEEstimate rowMSE(RowReader &image1, RowReader &image2, bool ignore_dimensions) {
+    checkDimensions(image1, image2, ignore_dimensions);
+    int width = std::min(image1.getWidth(), image2.getWidth());
+    int height = std::min(image1.getHeight(), image2.getHeight());
+    std::vector<rgbPixel> row1(image1.getWidth()), row2(image2.getWidth());
+    uint64_t dif_sum = 0;
+    for (int y = 0; y < height; ++y) {
+        image1.readRow(y, row1.data());
+        image2.readRow(y, row2.data());
+        dif_sum += rowSquaredError(row1.data(), row2.data(), width);
+    }
+    MSEEstimate estimate;
+    estimate.mse = estimate.mse_low = estimate.mse_high =
+        (double)dif_sum / ((double)width * height * 3);
+    estimate.compared_rows = estimate.total_rows = height;
+    return estimate;
+}
+
+MSEEstimate sampledMSE(RowReader &image1, RowReader &image2, double fraction,
+                       bool ignore_dimensions, uint64_t seed) {
+    checkDimensions(image1, image2, ignore_dimensions);
+    int width = std::min(image1.getWidth(), image2.getWidth());
+    int height = std::min(image1.getHeight(), image2.getHeight());
+    int strata = std::max(MIN_SAMPLED_ROWS, static_cast<int>(std::ceil(fraction * height)));
+    if (strata >= height) return rowMSE(image1, image2, ignore_dimensions);
+
+    std::mt19937_64 random(seed);
+    std::vector<rgbPixel> row1(image1.getWidth()), row2(image2.getWidth());
+    // Strata differ in size by at most one row, each row's MSE is weighted by its stratum
+    double weighted_sum = 0, sum = 0, sum_of_squares = 0;
+    for (int stratum = 0; stratum < strata; ++stratum) {
+        int first = static_cast<int>(static_cast<int64_t>(stratum) * height / strata);
+        int end = static_cast<int>(static_cast<int64_t>(stratum + 1) * height / strata);
+        int y = first + static_cast<int>(random() % (end - first));
+        image1.readRow(y, row1.data());
+        image2.readRow(y, row2.data());
+        double row_mse = rowSquaredError(row1.data(), row2.data(), width) / (width * 3.0);
+        weighted_sum += row_mse * (end - first);
+        sum += row_mse;
+        sum_of_squares += row_mse * row_mse;
+    }
+
+    MSEEstimate estimate;
+    estimate.mse = weighted_sum / height;
+    double mean = sum / strata;
+    double variance = std::max(0.0, (sum_of_squares - strata * mean * mean) / (strata - 1));
+    double finite_population = 1.0 - double(strata) / height;
+    double margin = CONFIDENCE_Z * std::sqrt(variance / strata * finite_population);
+    estimate.mse_low = std::max(0.0, estimate.mse - margin);
+    estimate.mse_high = estimate.mse + margin;
+    estimate.compared_rows = strata;
+    estimate.total_rows = height;
+    return estimate;
+}
+
+// Squared differences and sample counts of the Y, U and V planes of one frame
+static void frameErrors(ImageFormat format, const unsigned char *frame1,
+                        const unsigned char *frame2, int width, int height, double mse[3]) {
+    uint64_t sums[3] = {0, 0, 0}, counts[3] = {0, 0, 0};
+    for (int y = 0; y < height; ++y) {
+        YUVRow row1 = yuvRowAt(format, const_cast<unsigned char *>(frame1), width, height, y);
+        YUVRow row2 = yuvRowAt(format, const_cast<unsigned char *>(frame2), width, height, y);
+        uint64_t luma = 0;
+        for (int x = 0; x < width; ++x) {
+            luma += sqr(row1.y[x * row1.y_step] - row2.y[x * row2.y_step]);
+        }
+        sums[0] += luma;
+        counts[0] += width;
+        if (!yuvRowHasChroma(format, y)) continue;
+        uint64_t u = 0, v = 0;
+        int samples = ((width - 1) >> row1.uv_shift) + 1;
+        for (int i = 0; i < samples; ++i) {
+            u += sqr(row1.u[i * row1.uv_step] - row2.u[i * row2.uv_step]);
+            v += sqr(row1.v[i * row1.uv_step] - row2.v[i * row2.uv_step]);
+        }
+        sums[1] += u;
+        sums[2] += v;
+        counts[1] += samples;
+        counts[2] += samples;
+    }
+    for (int plane = 0; plane < 3; ++plane) mse[plane] = (double)sums[plane] / counts[plane];
+}
+
+int compareYUVSequences(const std::string &filename1, const std::string &filename2,
+                        ImageFormat format, int width, int height, int threads,
+                        const std::function<void(const YUVFrameErrors &)> &on_frame) {
+    if (!isYUVFormat(format)) throw std::invalid_argument("Sequence comparison needs a raw YUV format");
+    if (width <= 0 || height <= 0) throw std::invalid_argument("YUV formats require width and height");
+    if (threads <= 0) threads = std::max(1u, std::thread::hardware_concurrency());
+
+    MappedFile file1(filename1), file2(filename2);
+    size_t frame_size = yuvFrameSize(format, width, height);
+    int frames = static_cast<int>(std::min(file1.getSize(), file2.getSize()) / frame_size);
+
+    // A window of frames is compared in parallel and reported in order before the next starts
+    int window = threads * 2;
+    std::vector<YUVFrameErrors> results(window);
+    for (int start = 0; start < frames; start += window) {
+        int end = std::min(frames, start + window);
+        std::atomic<int> next(start);
+        auto worker = [&]() {
+            for (int frame = next++; frame < end; frame = next++) {
+                YUVFrameErrors &result = results[frame - start];
+                result.frame = frame;
+                frameErrors(format, file1.bytes() + frame * frame_size,
+                            file2.bytes() + frame * frame_size, width, height, result.mse);
+            }
+        };
+        std::vector<std::thread> workers;
+        for (int i = 1; i < std::min(threads, end - start); ++i) workers.emplace_back(worker);
+        worker();
+        for (std::thread &thread : workers) thread.join();
+
+        for (int frame = start; frame < end; ++frame) on_frame(results[frame - start]);
+        file1.release(start * frame_size, (end - start) * frame_size);
+        file2.release(start * frame_size, (end - start) * frame_size);
+    }
+    return frames;
+}
+
+static constexpr int PSNR_BINS_PER_DB = 100;
+static constexpr int PSNR_MAX_DB = 100;
+
+PSNRSummary::PSNRSummary() : histogram(PSNR_MAX_DB * PSNR_BINS_PER_DB + 1) {}
+
+void PSNRSummary::add(double value) {
+    min = count ? std::min(min, value) : value;
+    max = count ? std::max(max, value) : value;
+    sum += value;
+    ++count;
+    int bin = static_cast<int>(std::lround(value * PSNR_BINS_PER_DB));
+    ++histogram[std::min(std::max(bin, 0), static_cast<int>(histogram.size()) - 1)];
+}
+
+double PSNRSummary::percentile(double p) const {
+    if (!count) return 0;
+    // Nearest rank, the smallest value with at least p% of the values at or below it
+    uint64_t rank = std::max<uint64_t>(1, static_cast<uint64_t>(std::ceil(p / 100 * count)));
+    uint64_t seen = 0;
+    for (size_t bin = 0; bin < histogram.size(); ++bin) {
+        seen += histogram[bin];
+        if (seen >= rank) return std::min(std::max(double(bin) / PSNR_BINS_PER_DB, min), max);
+    }
+    return max;
+}
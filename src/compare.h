@@ -1,5 +1,76 @@
 #pragma once
 #include "image.h"
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
 
-double MSE(Image image1, Image image2, bool ignore_dimensions);
+double MSE(const Image &image1, const Image &image2, bool ignore_dimensions);
 double psnr(double mse, int max_pixel_value);
+
+// Random access to the rows of an image file. BMP and raw YUV files are memory mapped, so
+// only the rows that are read get loaded and converted; other formats are decoded up front.
+class RowReader {
+  public:
+    virtual ~RowReader() = default;
+    virtual int getWidth() const noexcept = 0;
+    virtual int getHeight() const noexcept = 0;
+    // Converts row y to RGB, out must hold getWidth() pixels
+    virtual void readRow(int y, rgbPixel *out) = 0;
+};
+
+// width and height are only used by the raw YUV formats
+std::unique_ptr<RowReader> openRowReader(const std::string &filename, ImageFormat format,
+                                         int width = 0, int height = 0);
+
+struct MSEEstimate {
+    double mse = 0;
+    // 95% confidence interval, equal to mse when every row was compared
+    double mse_low = 0, mse_high = 0;
+    int compared_rows = 0;
+    int total_rows = 0;
+    bool exact() const noexcept { return compared_rows == total_rows; }
+};
+
+// Compares every row, in constant memory
+MSEEstimate rowMSE(RowReader &image1, RowReader &image2, bool ignore_dimensions);
+// Compares one random row from each of fraction * height equal strata. The interval uses
+// the variance of simple random sampling, which overstates the error of the stratified
+// sample, so it is conservative.
+MSEEstimate sampledMSE(RowReader &image1, RowReader &image2, double fraction,
+                       bool ignore_dimensions, uint64_t seed = 1);
+
+// Per plane MSE of one frame pair, in Y, U, V order
+struct YUVFrameErrors {
+    int frame;
+    double mse[3];
+};
+
+// Compares two raw YUV sequences frame by frame on the stored samples, without converting to
+// RGB. Both files are memory mapped and frames are compared by several threads a window at a
+// time; pages of finished windows are released, so memory use doesn't grow with the length.
+// on_frame is called in frame order. Returns the number of frames compared, the shorter
+// sequence determines it.
+int compareYUVSequences(const std::string &filename1, const std::string &filename2,
+                        ImageFormat format, int width, int height, int threads,
+                        const std::function<void(const YUVFrameErrors &)> &on_frame);
+
+// Min, mean, max and percentiles of a stream of PSNR values in fixed memory. Percentiles
+// come from a histogram over [0, 100] dB with 0.01 dB bins.
+class PSNRSummary {
+  public:
+    PSNRSummary();
+    void add(double value);
+    int getCount() const noexcept { return count; }
+    double getMin() const noexcept { return min; }
+    double getMax() const noexcept { return max; }
+    double getMean() const noexcept { return count ? sum / count : 0; }
+    // p in [0, 100]
+    double percentile(double p) const;
+
+  private:
+    std::vector<uint64_t> histogram;
+    int count = 0;
+    double min = 0, max = 0, sum = 0;
+};
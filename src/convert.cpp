@@ -0,0 +1,175 @@
+#include "convert.h"
+
+#include <algorithm>
+#include <stdexcept>
+
+static constexpr int KERNEL_BLOCK = 256;
+
+static inline unsigned char clampByte(int value) noexcept {
+    return static_cast<unsigned char>(std::min(std::max(value, 0), 255));
+}
+
+bool isYUVFormat(ImageFormat format) noexcept {
+    switch (format) {
+    case ImageFormat::YUV420P:
+    case ImageFormat::YUV422P:
+    case ImageFormat::YUV444P:
+    case ImageFormat::NV12:
+    case ImageFormat::NV21:
+    case ImageFormat::YUYV:
+    case ImageFormat::UYVY:
+        return true;
+    default:
+        return false;
+    }
+}
+
+size_t yuvFrameSize(ImageFormat format, int width, int height) {
+    size_t luma = static_cast<size_t>(width) * height;
+    size_t half_width = (width + 1) / 2;
+    size_t half_height = (height + 1) / 2;
+    switch (format) {
+    case ImageFormat::YUV420P:
+    case ImageFormat::NV12:
+    case ImageFormat::NV21:
+        return luma + 2 * half_width * half_height;
+    case ImageFormat::YUV422P:
+        return luma + 2 * half_width * height;
+    case ImageFormat::YUV444P:
+        return 3 * luma;
+    case ImageFormat::YUYV:
+    case ImageFormat::UYVY:
+        return 4 * half_width * height;
+    default:
+        throw std::invalid_argument("Unsupported image format");
+    }
+}
+
+YUVRow yuvRowAt(ImageFormat format, unsigned char *frame, int width, int height, int y) {
+    size_t luma = static_cast<size_t>(width) * height;
+    size_t half_width = (width + 1) / 2;
+    size_t half_height = (height + 1) / 2;
+    unsigned char *luma_row = frame + static_cast<size_t>(y) * width;
+    switch (format) {
+    case ImageFormat::YUV420P: {
+        unsigned char *u = frame + luma + (y / 2) * half_width;
+        return {luma_row, 1, u, u + half_width * half_height, 1, 1};
+    }
+    case ImageFormat::YUV422P: {
+        unsigned char *u = frame + luma + y * half_width;
+        return {luma_row, 1, u, u + half_width * height, 1, 1};
+    }
+    case ImageFormat::YUV444P: {
+        unsigned char *u = frame + luma + static_cast<size_t>(y) * width;
+        return {luma_row, 1, u, u + luma, 1, 0};
+    }
+    case ImageFormat::NV12:
+    case ImageFormat::NV21: {
+        unsigned char *uv = frame + luma + (y / 2) * half_width * 2;
+        if (format == ImageFormat::NV12) return {luma_row, 1, uv, uv + 1, 2, 1};
+        return {luma_row, 1, uv + 1, uv, 2, 1};
+    }
+    case ImageFormat::YUYV: {
+        unsigned char *packed = frame + y * half_width * 4;
+        return {packed, 2, packed + 1, packed + 3, 4, 1};
+    }
+    case ImageFormat::UYVY: {
+        unsigned char *packed = frame + y * half_width * 4;
+        return {packed + 1, 2, packed, packed + 2, 4, 1};
+    }
+    default:
+        throw std::invalid_argument("Unsupported image format");
+    }
+}
+
+bool yuvRowHasChroma(ImageFormat format, int y) noexcept {
+    switch (format) {
+    case ImageFormat::YUV420P:
+    case ImageFormat::NV12:
+    case ImageFormat::NV21:
+        return y % 2 == 0;
+    default:
+        return true;
+    }
+}
+
+void yuvRowToRgb(const YUVRow &row, rgbPixel *out, int width) noexcept {
+    int ys[KERNEL_BLOCK], us[KERNEL_BLOCK], vs[KERNEL_BLOCK];
+    for (int x0 = 0; x0 < width; x0 += KERNEL_BLOCK) {
+        int n = std::min(KERNEL_BLOCK, width - x0);
+        for (int i = 0; i < n; ++i) {
+            int x = x0 + i;
+            ys[i] = row.y[x * row.y_step];
+            us[i] = row.u[(x >> row.uv_shift) * row.uv_step] - 128;
+            vs[i] = row.v[(x >> row.uv_shift) * row.uv_step] - 128;
+        }
+        // Same arithmetic as rgbPixel(const yuvPixel &), so all formats convert identically
+        for (int i = 0; i < n; ++i) {
+            int r = ys[i] + yuvPixel::YUV_TO_R_U * us[i] + yuvPixel::YUV_TO_R_V * vs[i];
+            int g = ys[i] + yuvPixel::YUV_TO_G_U * us[i] + yuvPixel::YUV_TO_G_V * vs[i];
+            int b = ys[i] + yuvPixel::YUV_TO_B_U * us[i] + yuvPixel::YUV_TO_B_V * vs[i];
+            out[x0 + i].r = clampByte(r);
+            out[x0 + i].g = clampByte(g);
+            out[x0 + i].b = clampByte(b);
+        }
+    }
+}
+
+void rgbRowToYuv(const rgbPixel *in, int width, bool grayscale, const YUVRow &row,
+                 bool write_chroma) noexcept {
+    int rs[KERNEL_BLOCK], gs[KERNEL_BLOCK], bs[KERNEL_BLOCK];
+    unsigned char ys[KERNEL_BLOCK], us[KERNEL_BLOCK], vs[KERNEL_BLOCK];
+    int chroma_mask = (1 << row.uv_shift) - 1;
+    for (int x0 = 0; x0 < width; x0 += KERNEL_BLOCK) {
+        int n = std::min(KERNEL_BLOCK, width - x0);
+        for (int i = 0; i < n; ++i) {
+            rs[i] = in[x0 + i].r;
+            gs[i] = in[x0 + i].g;
+            bs[i] = in[x0 + i].b;
+        }
+        if (grayscale) {
+            for (int i = 0; i < n; ++i) {
+                int gray = clampByte(rgbPixel::RGB_TO_Y_R * rs[i] + rgbPixel::RGB_TO_Y_G * gs[i] +
+                                     rgbPixel::RGB_TO_Y_B * bs[i]);
+                rs[i] = gs[i] = bs[i] = gray;
+            }
+        }
+        // Same arithmetic as yuvPixel(const rgbPixel &)
+        for (int i = 0; i < n; ++i) {
+            ys[i] = clampByte(rgbPixel::RGB_TO_Y_R * rs[i] + rgbPixel::RGB_TO_Y_G * gs[i] +
+                              rgbPixel::RGB_TO_Y_B * bs[i]);
+        }
+        for (int i = 0; i < n; ++i) {
+            row.y[(x0 + i) * row.y_step] = ys[i];
+        }
+        if (!write_chroma) continue;
+        for (int i = 0; i < n; ++i) {
+            us[i] = clampByte(128 + rgbPixel::RGB_TO_U_R * rs[i] + rgbPixel::RGB_TO_U_G * gs[i] +
+                              rgbPixel::RGB_TO_U_B * bs[i]);
+            vs[i] = clampByte(128 + rgbPixel::RGB_TO_V_R * rs[i] + rgbPixel::RGB_TO_V_G * gs[i] +
+                              rgbPixel::RGB_TO_V_B * bs[i]);
+        }
+        // Chroma is taken from the first pixel of each subsampled block
+        for (int i = 0; i < n; ++i) {
+            int x = x0 + i;
+            if (x & chroma_mask) continue;
+            row.u[(x >> row.uv_shift) * row.uv_step] = us[i];
+            row.v[(x >> row.uv_shift) * row.uv_step] = vs[i];
+        }
+    }
+}
+
+void packYuv444Frame(const unsigned char *frame, int width, int height, ImageFormat format,
+                     unsigned char *out) {
+    unsigned char *source = const_cast<unsigned char *>(frame);
+    for (int y = 0; y < height; ++y) {
+        YUVRow from = yuvRowAt(ImageFormat::YUV444P, source, width, height, y);
+        YUVRow to = yuvRowAt(format, out, width, height, y);
+        for (int x = 0; x < width; ++x) to.y[x * to.y_step] = from.y[x];
+        if (!yuvRowHasChroma(format, y)) continue;
+        for (int x = 0; x < width; x += 1 << to.uv_shift) {
+            to.u[(x >> to.uv_shift) * to.uv_step] = from.u[x];
+            to.v[(x >> to.uv_shift) * to.uv_step] = from.v[x];
+        }
+    }
+}
@@ -0,0 +1,34 @@
+#pragma once
+#include "image.h"
+#include <cstddef>
+
+// Position of the samples of one image row in a YUV buffer: sample x of the luma is at
+// y[x * y_step] and of the chroma at u[(x >> uv_shift) * uv_step] (same for v). This covers
+// planar, semi-planar (NV12/NV21) and packed (YUYV/UYVY) layouts without repacking.
+struct YUVRow {
+    unsigned char *y;
+    int y_step;
+    unsigned char *u;
+    unsigned char *v;
+    int uv_step;
+    int uv_shift;
+};
+
+bool isYUVFormat(ImageFormat format) noexcept;
+// Size in bytes of one frame of a raw YUV format
+size_t yuvFrameSize(ImageFormat format, int width, int height);
+// Row y of a frame stored in the given raw YUV format starting at frame
+YUVRow yuvRowAt(ImageFormat format, unsigned char *frame, int width, int height, int y);
+// Whether row y carries its own chroma samples (false for odd rows of 4:2:0 formats)
+bool yuvRowHasChroma(ImageFormat format, int y) noexcept;
+
+// Row conversion kernels, they work on small blocks of contiguous samples so the
+// compiler can vectorize the arithmetic regardless of the source layout
+void yuvRowToRgb(const YUVRow &row, rgbPixel *out, int width) noexcept;
+void rgbRowToYuv(const rgbPixel *in, int width, bool grayscale, const YUVRow &row,
+                 bool write_chroma) noexcept;
+// Repacks a YUV444P frame into another raw YUV format, sampling chroma like rgbRowToYuv.
+// Converting once to YUV444P and packing from it gives the same bytes as converting from
+// RGB for every format.
+void packYuv444Frame(const unsigned char *frame, int width, int height, ImageFormat format,
+                     unsigned char *out);
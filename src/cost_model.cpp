@@ -0,0 +1,261 @@
+#include "cost_model.h"
+#include "cache.h"
+#include "upscaler_module.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <iomanip>
+#include <sstream>
+#include <stdexcept>
+#include <sys/stat.h>
+
+// Weight kept by older timings whenever a new one is observed
+static constexpr double DECAY = 0.9;
+static constexpr int CALIBRATION_SIZES[] = {48, 96, 192};
+
+// Seconds per output pixel derived from the cat_comparison.txt run, used until the method
+// has been timed on this machine
+static double priorSecondsPerPixel(UpscaleMethod method) {
+    switch (method) {
+    case UpscaleMethod::BICUBIC:
+        return 2.5e-9;
+    case UpscaleMethod::LANCZOS:
+    case UpscaleMethod::BTVL1:
+        return 3.3e-9;
+    case UpscaleMethod::ESPCN:
+        return 6.4e-8;
+    case UpscaleMethod::FSRCNN:
+        return 9.0e-8;
+    case UpscaleMethod::LAPSRN:
+        return 5.1e-7;
+    case UpscaleMethod::EDSR:
+        return 3.1e-5;
+    default:
+        return 1e-6;
+    }
+}
+
+static bool fileExists(const std::string &path) {
+    struct stat info;
+    return stat(path.c_str(), &info) == 0;
+}
+
+std::string CostModel::defaultPath() {
+    if (const char *path = getenv("IMAGETOOL_COST_PROFILE")) return path;
+    return userCacheDirectory() + "/cost_profile.txt";
+}
+
+bool CostModel::load(const std::string &path) {
+    std::ifstream file(path);
+    if (!file) return false;
+    std::string line;
+    while (std::getline(file, line)) {
+        if (line.empty() || line[0] == '#') continue;
+        std::istringstream fields(line);
+        std::string method_name;
+        int scale;
+        Sums sums;
+        if (!(fields >> method_name >> scale >> sums.weight >> sums.x >> sums.y >> sums.xx >>
+              sums.xy >> sums.count)) {
+            continue;
+        }
+        try {
+            entries[{UpscalerFactory::stringToMethod(method_name), scale}] = sums;
+        } catch (const std::exception &) {
+            // Methods this build doesn't know about are dropped
+        }
+    }
+    return true;
+}
+
+void CostModel::save(const std::string &path) const {
+    std::string temporary = path + ".tmp";
+    {
+        std::ofstream file(temporary);
+        file << "# method scale weight sum_x sum_y sum_xx sum_xy count, x = output pixels, "
+                "y = seconds\n";
+        file << std::setprecision(17);
+        for (const auto &[key, sums] : entries) {
+            file << UpscalerFactory::methodToString(key.first) << " " << key.second << " "
+                 << sums.weight << " " << sums.x << " " << sums.y << " " << sums.xx << " "
+                 << sums.xy << " " << sums.count << "\n";
+        }
+        if (!file) throw std::runtime_error("Couldn't write cost profile \"" + temporary + "\"");
+    }
+    if (rename(temporary.c_str(), path.c_str()) != 0) {
+        remove(temporary.c_str());
+        throw std::runtime_error("Couldn't write cost profile \"" + path + "\"");
+    }
+}
+
+double CostModel::estimate(UpscaleMethod method, int width, int height, int scale) const {
+    double pixels = static_cast<double>(width) * height * scale * scale;
+    auto entry = entries.find({method, scale});
+    if (entry == entries.end() || entry->second.count == 0) {
+        return (UpscalerFactory::isAIMethod(method) ? 0.02 : 0.0) +
+               priorSecondsPerPixel(method) * pixels;
+    }
+
+    const Sums &s = entry->second;
+    double per_pixel = s.xy / s.xx;
+    double fixed = 0;
+    double denominator = s.weight * s.xx - s.x * s.x;
+    if (s.count >= 2 && denominator > 1e-9 * s.weight * s.xx) {
+        double slope = (s.weight * s.xy - s.x * s.y) / denominator;
+        double intercept = (s.y - slope * s.x) / s.weight;
+        if (slope > 0 && intercept >= 0) {
+            per_pixel = slope;
+            fixed = intercept;
+        }
+    }
+    return std::max(fixed + per_pixel * pixels, 0.0);
+}
+
+int CostModel::samples(UpscaleMethod method, int scale) const {
+    auto entry = entries.find({method, scale});
+    return entry == entries.end() ? 0 : entry->second.count;
+}
+
+void CostModel::observe(UpscaleMethod method, int width, int height, int scale, double seconds) {
+    double pixels = static_cast<double>(width) * height * scale * scale;
+    Sums &s = entries[{method, scale}];
+    s.weight = s.weight * DECAY + 1;
+    s.x = s.x * DECAY + pixels;
+    s.y = s.y * DECAY + seconds;
+    s.xx = s.xx * DECAY + pixels * pixels;
+    s.xy = s.xy * DECAY + pixels * seconds;
+    ++s.count;
+}
+
+void CostModel::calibrate(const std::string &model_dir, const std::vector<int> &scales,
+                          std::ostream &log) {
+    // Loading the upscaler module is a one-off cost per process, not part of any method's
+    // measured time, so it is paid before the timed runs
+    upscalerModule();
+    for (UpscaleMethod method : UpscalerFactory::getAvailableMethods()) {
+        for (int scale : scales) {
+            std::string name = UpscalerFactory::methodToString(method);
+            std::string model_path;
+            if (UpscalerFactory::isAIMethod(method)) {
+                model_path = model_dir + modelFileName(method, scale);
+                if (!fileExists(model_path)) {
+                    log << name << " x" << scale << ": skipped, no " << model_path << std::endl;
+                    continue;
+                }
+            }
+            for (int size : CALIBRATION_SIZES) {
+                Image image(size, size);
+                for (int y = 0; y < size; ++y) {
+                    for (int x = 0; x < size; ++x) {
+                        image.setPixel(x, y, rgbPixel(x * 255 / size, y * 255 / size,
+                                                      (x * 7 + y * 13) % 256));
+                    }
+                }
+                try {
+                    auto start = std::chrono::high_resolution_clock::now();
+                    auto upscaler = UpscalerFactory::createUpscaler(method, model_path);
+                    upscaler->upscale(image, scale);
+                    auto end = std::chrono::high_resolution_clock::now();
+                    double seconds = std::chrono::duration<double>(end - start).count();
+                    observe(method, size, size, scale, seconds);
+                    log << name << " x" << scale << " " << size << "x" << size << ": "
+                        << seconds * 1000 << " ms" << std::endl;
+                } catch (const std::exception &e) {
+                    log << name << " x" << scale << ": failed, " << e.what() << std::endl;
+                    break;
+                }
+            }
+        }
+    }
+}
+
+const std::vector<UpscaleMethod> &methodsByQuality() {
+    // Mean PSNR over the four example images: EDSR 23.88, ESPCN 23.34, FSRCNN 23.32,
+    // LAPSRN 23.25, BICUBIC 23.13, LANCZOS 23.12 dB. The margins between neighbours are small
+    // and single images can rank differently (on the cat image Lanczos comes right after EDSR).
+    // BTVL1 is left out, on single images it is Lanczos.
+    static const std::vector<UpscaleMethod> methods = {
+        UpscaleMethod::EDSR,   UpscaleMethod::ESPCN,   UpscaleMethod::FSRCNN,
+        UpscaleMethod::LAPSRN, UpscaleMethod::BICUBIC, UpscaleMethod::LANCZOS};
+    return methods;
+}
+
+std::string modelFileName(UpscaleMethod method, int scale) {
+    std::string suffix = "_x" + std::to_string(scale) + ".pb";
+    switch (method) {
+    case UpscaleMethod::ESPCN:
+        return "ESPCN" + suffix;
+    case UpscaleMethod::EDSR:
+        return "EDSR" + suffix;
+    case UpscaleMethod::FSRCNN:
+        return "FSRCNN" + suffix;
+    case UpscaleMethod::LAPSRN:
+        return "LapSRN" + suffix;
+    default:
+        return "";
+    }
+}
+
+DeadlineChoice chooseMethodForDeadline(const CostModel &model, const std::string &model_dir,
+                                       UpscaleMethod ceiling, int width, int height, int scale,
+                                       double deadline_seconds) {
+    DeadlineChoice choice{UpscaleMethod::BICUBIC, "", 0, false, {}};
+    // BTVL1 isn't ranked, it upscales single images with Lanczos and stands for it here
+    if (ceiling == UpscaleMethod::BTVL1) {
+        choice.report.push_back("BTVL1: ranked as LANCZOS");
+        ceiling = UpscaleMethod::LANCZOS;
+    }
+    const std::vector<UpscaleMethod> &methods = methodsByQuality();
+    auto first = std::find(methods.begin(), methods.end(), ceiling);
+    if (first == methods.end()) {
+        throw std::invalid_argument(UpscalerFactory::methodToString(ceiling) +
+                                    " has no quality rank for --deadline-ms");
+    }
+
+    bool chosen = false, have_fallback = false;
+    for (auto it = first; it != methods.end(); ++it) {
+        UpscaleMethod method = *it;
+        std::ostringstream line;
+        line << UpscalerFactory::methodToString(method) << ": ";
+
+        std::string model_path;
+        if (UpscalerFactory::isAIMethod(method)) {
+            model_path = model_dir + modelFileName(method, scale);
+            if (!fileExists(model_path)) {
+                line << "unavailable, no " << model_path;
+                choice.report.push_back(line.str());
+                continue;
+            }
+        }
+
+        double estimate = model.estimate(method, width, height, scale);
+        int samples = model.samples(method, scale);
+        line << std::fixed << std::setprecision(1) << estimate * 1000 << " ms estimated ("
+             << (samples ? std::to_string(samples) + " timings" : std::string("prior")) << ")";
+
+        bool fits = estimate <= deadline_seconds;
+        if (!chosen && fits) {
+            choice = {method, model_path, estimate, true, choice.report};
+            chosen = true;
+            line << ", chosen: best quality within the deadline";
+        } else if (chosen) {
+            line << ", lower quality than the chosen method";
+        } else {
+            line << ", over the deadline";
+        }
+        if (!chosen && (!have_fallback || estimate < choice.estimate_seconds)) {
+            choice.method = method;
+            choice.model_path = model_path;
+            choice.estimate_seconds = estimate;
+            have_fallback = true;
+        }
+        choice.report.push_back(line.str());
+    }
+    if (!chosen) {
+        choice.report.push_back("Nothing fits the deadline, using the cheapest method " +
+                                UpscalerFactory::methodToString(choice.method));
+    }
+    return choice;
+}
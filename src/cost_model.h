@@ -0,0 +1,60 @@
+#pragma once
+#include "upscaler.h"
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+
+// Per-machine latency model of the upscalers: seconds = fixed + per_pixel * output_pixels,
+// fitted separately for every (method, scale) by least squares over exponentially decayed
+// sums of the observed timings, so recent runs on this machine count the most.
+class CostModel {
+  public:
+    // $IMAGETOOL_COST_PROFILE, otherwise cost_profile.txt in the user cache directory
+    static std::string defaultPath();
+
+    // A missing profile leaves the model empty and returns false
+    bool load(const std::string &path);
+    void save(const std::string &path) const;
+
+    // Estimated seconds to create the upscaler and upscale a width x height image
+    double estimate(UpscaleMethod method, int width, int height, int scale) const;
+    // Number of timings behind the estimate, 0 when it comes from the built-in prior
+    int samples(UpscaleMethod method, int scale) const;
+    void observe(UpscaleMethod method, int width, int height, int scale, double seconds);
+
+    // Times every method at a few small sizes on synthetic input and records the results,
+    // AI methods are skipped when their model is missing from model_dir
+    void calibrate(const std::string &model_dir, const std::vector<int> &scales,
+                   std::ostream &log);
+
+  private:
+    struct Sums {
+        double weight = 0;
+        double x = 0, y = 0, xx = 0, xy = 0;
+        int count = 0;
+    };
+    std::map<std::pair<UpscaleMethod, int>, Sums> entries;
+};
+
+// Methods ordered from best to worst mean PSNR, as measured by upscale_comparison on the
+// example images (see *_comparison.txt)
+const std::vector<UpscaleMethod> &methodsByQuality();
+// Model file for an AI method at the given scale, empty for traditional methods
+std::string modelFileName(UpscaleMethod method, int scale);
+
+struct DeadlineChoice {
+    UpscaleMethod method;
+    std::string model_path;
+    double estimate_seconds;
+    bool fits;
+    // One line per candidate with its estimate and why it was or wasn't taken
+    std::vector<std::string> report;
+};
+
+// Picks the best quality method whose estimated cost fits in deadline_seconds, never better
+// than ceiling (BTVL1 counts as LANCZOS). Falls back to the cheapest candidate when nothing
+// fits.
+DeadlineChoice chooseMethodForDeadline(const CostModel &model, const std::string &model_dir,
+                                       UpscaleMethod ceiling, int width, int height, int scale,
+                                       double deadline_seconds);
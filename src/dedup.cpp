@@ -0,0 +1,154 @@
+#include "dedup.h"
+#include "cache.h"
+
+#include <algorithm>
+#include <vector>
+
+// Above this share of dirty tiles processing the whole frame is cheaper than tiling
+static constexpr double FULL_FRAME_DIRTY_RATIO = 0.5;
+
+static int roundUp(int value, int multiple) { return (value + multiple - 1) / multiple * multiple; }
+
+TemporalDeduplicator::TemporalDeduplicator(Processor process, int scale_numerator,
+                                           int scale_denominator, int tile_size, int halo,
+                                           double mse_threshold)
+    : process(std::move(process)), scale_numerator(scale_numerator),
+      scale_denominator(scale_denominator),
+      tile_size(roundUp(std::max(tile_size, 1), scale_denominator)),
+      halo(roundUp(std::max(halo, 0), scale_denominator)), mse_threshold(mse_threshold),
+      has_reference(false) {}
+
+const DedupStats &TemporalDeduplicator::getStats() const noexcept { return stats; }
+
+int TemporalDeduplicator::toOutput(int coordinate) const noexcept {
+    return static_cast<int>(static_cast<int64_t>(coordinate) * scale_numerator /
+                            scale_denominator);
+}
+
+uint64_t TemporalDeduplicator::tileHash(const Image &image, int x, int y, int w, int h) const {
+    uint64_t hash = 0;
+    std::vector<rgbPixel> buffer(w);
+    for (int row = y; row < y + h; ++row) {
+        hash = hashBytes(image.readPixels(x, row, w, buffer.data()), w * sizeof(rgbPixel), hash);
+    }
+    return hash;
+}
+
+double TemporalDeduplicator::tileMSE(const Image &image, int x, int y, int w, int h) const {
+    int64_t sum = 0;
+    std::vector<rgbPixel> buffer_a(w), buffer_b(w);
+    for (int row = y; row < y + h; ++row) {
+        const rgbPixel *a = image.readPixels(x, row, w, buffer_a.data());
+        const rgbPixel *b = reference.readPixels(x, row, w, buffer_b.data());
+        sum += squaredErrorBytes(reinterpret_cast<const unsigned char *>(a),
+                                 reinterpret_cast<const unsigned char *>(b), w * sizeof(rgbPixel));
+    }
+    return static_cast<double>(sum) / (static_cast<int64_t>(w) * h * 3);
+}
+
+void TemporalDeduplicator::processFull(Image &frame) {
+    reference = frame;
+    int columns = (frame.width + tile_size - 1) / tile_size;
+    int rows = (frame.height + tile_size - 1) / tile_size;
+    reference_hashes.assign(columns * rows, 0);
+    for (int ty = 0; ty < rows; ++ty) {
+        for (int tx = 0; tx < columns; ++tx) {
+            int x = tx * tile_size, y = ty * tile_size;
+            reference_hashes[ty * columns + tx] =
+                tileHash(frame, x, y, std::min(tile_size, frame.width - x),
+                         std::min(tile_size, frame.height - y));
+        }
+    }
+    process(frame);
+    output = frame;
+    has_reference = true;
+    stats.tiles += columns * rows;
+}
+
+void TemporalDeduplicator::processFrame(Image &frame) {
+    ++stats.frames;
+    if (!has_reference || frame.width != reference.width || frame.height != reference.height ||
+        frame.is_grayscale != reference.is_grayscale) {
+        processFull(frame);
+        return;
+    }
+
+    int columns = (frame.width + tile_size - 1) / tile_size;
+    int rows = (frame.height + tile_size - 1) / tile_size;
+    std::vector<uint64_t> hashes(columns * rows);
+    std::vector<char> changed(columns * rows, 0);
+    int changed_count = 0;
+    for (int ty = 0; ty < rows; ++ty) {
+        for (int tx = 0; tx < columns; ++tx) {
+            int x = tx * tile_size, y = ty * tile_size;
+            int w = std::min(tile_size, frame.width - x), h = std::min(tile_size, frame.height - y);
+            int index = ty * columns + tx;
+            hashes[index] = tileHash(frame, x, y, w, h);
+            if (hashes[index] == reference_hashes[index]) continue;
+            if (mse_threshold > 0 && tileMSE(frame, x, y, w, h) <= mse_threshold) continue;
+            changed[index] = 1;
+            ++changed_count;
+        }
+    }
+
+    stats.tiles += columns * rows;
+    if (changed_count == 0) {
+        ++stats.reused_frames;
+        stats.reused_tiles += columns * rows;
+        frame = output;
+        return;
+    }
+
+    // A tile's output depends on the halo around it, so every tile whose halo reaches a
+    // changed tile is stale too
+    std::vector<char> dirty = changed;
+    int reach = (halo + tile_size - 1) / tile_size;
+    if (reach > 0) {
+        for (int ty = 0; ty < rows; ++ty) {
+            for (int tx = 0; tx < columns; ++tx) {
+                if (!changed[ty * columns + tx]) continue;
+                for (int ny = std::max(ty - reach, 0); ny <= std::min(ty + reach, rows - 1);
+                     ++ny) {
+                    for (int nx = std::max(tx - reach, 0);
+                         nx <= std::min(tx + reach, columns - 1); ++nx) {
+                        dirty[ny * columns + nx] = 1;
+                    }
+                }
+            }
+        }
+    }
+    int dirty_count = std::count(dirty.begin(), dirty.end(), 1);
+    if (dirty_count > FULL_FRAME_DIRTY_RATIO * columns * rows) {
+        stats.tiles -= columns * rows;
+        processFull(frame);
+        return;
+    }
+
+    for (int ty = 0; ty < rows; ++ty) {
+        for (int tx = 0; tx < columns; ++tx) {
+            int index = ty * columns + tx;
+            if (!dirty[index]) continue;
+            int x = tx * tile_size, y = ty * tile_size;
+            int w = std::min(tile_size, frame.width - x), h = std::min(tile_size, frame.height - y);
+
+            int crop_x = std::max(x - halo, 0), crop_y = std::max(y - halo, 0);
+            int crop_w = std::min(x + w + halo, frame.width) - crop_x;
+            int crop_h = std::min(y + h + halo, frame.height) - crop_y;
+            Image tile = frame.crop(crop_x, crop_y, crop_w, crop_h);
+            process(tile);
+
+            int out_x = toOutput(x), out_y = toOutput(y);
+            int out_w = std::min(toOutput(x + w), output.width) - out_x;
+            int out_h = std::min(toOutput(y + h), output.height) - out_y;
+            output.paste(tile, out_x - toOutput(crop_x), out_y - toOutput(crop_y), out_x, out_y,
+                         std::min(out_w, tile.width - (out_x - toOutput(crop_x))),
+                         std::min(out_h, tile.height - (out_y - toOutput(crop_y))));
+            // Only tiles that were recomputed move their reference forward, so slow drift
+            // below the threshold still accumulates against the original input
+            reference.paste(frame, x, y, x, y, w, h);
+            reference_hashes[index] = hashes[index];
+        }
+    }
+    stats.reused_tiles += columns * rows - dirty_count;
+    frame = output;
+}
@@ -0,0 +1,54 @@
+#pragma once
+#include "image.h"
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+struct DedupStats {
+    uint64_t frames = 0;
+    uint64_t reused_frames = 0;
+    uint64_t tiles = 0;
+    uint64_t reused_tiles = 0;
+
+    double reuseRatio() const noexcept { return tiles ? double(reused_tiles) / tiles : 0.0; }
+};
+
+// Runs a per-frame processor over a frame sequence, recomputing only the tiles whose input
+// changed since their output was last computed. Dirty tiles are processed together with a
+// halo of surrounding input, and the dirty set is grown by ceil(halo / tile size) tiles so
+// that neighbours whose halo overlaps a change are refreshed too. The processor must scale both dimensions by
+// scale_numerator / scale_denominator; tile size and halo are rounded up to multiples of the
+// denominator so that tile borders map to whole output pixels.
+class TemporalDeduplicator {
+  public:
+    using Processor = std::function<void(Image &)>;
+
+    // mse_threshold == 0 reuses only bit-exact tiles, otherwise tiles whose MSE against
+    // the reference input is at most the threshold
+    TemporalDeduplicator(Processor process, int scale_numerator, int scale_denominator,
+                         int tile_size = 64, int halo = 16, double mse_threshold = 0);
+
+    // Replaces frame with the processed output
+    void processFrame(Image &frame);
+    const DedupStats &getStats() const noexcept;
+
+  private:
+    void processFull(Image &frame);
+    uint64_t tileHash(const Image &image, int x, int y, int w, int h) const;
+    double tileMSE(const Image &image, int x, int y, int w, int h) const;
+    int toOutput(int coordinate) const noexcept;
+
+    Processor process;
+    int scale_numerator;
+    int scale_denominator;
+    int tile_size;
+    int halo;
+    double mse_threshold;
+
+    // Input the current output tiles were computed from, with one hash per tile
+    Image reference;
+    std::vector<uint64_t> reference_hashes;
+    Image output;
+    bool has_reference;
+    DedupStats stats;
+};
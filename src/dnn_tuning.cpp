@@ -0,0 +1,196 @@
+#include "dnn_tuning.h"
+#include "cache.h"
+#include "cost_model.h"
+#include "upscaler.h"
+#include "upscaler_module.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <sstream>
+#include <stdexcept>
+#include <sys/stat.h>
+#include <thread>
+
+static constexpr int TIMED_RUNS = 3;
+static constexpr int SIZE_CLASS_LIMITS[] = {128 * 128, 320 * 320, 800 * 800};
+
+std::string DnnTuningProfile::defaultPath() {
+    if (const char *path = getenv("IMAGETOOL_DNN_PROFILE")) return path;
+    return userCacheDirectory() + "/dnn_profile.txt";
+}
+
+int DnnTuningProfile::sizeClass(int width, int height) noexcept {
+    long long pixels = static_cast<long long>(width) * height;
+    int size_class = 0;
+    for (int limit : SIZE_CLASS_LIMITS) {
+        if (pixels <= limit) break;
+        ++size_class;
+    }
+    return size_class;
+}
+
+bool DnnTuningProfile::load(const std::string &path) {
+    std::ifstream file(path);
+    if (!file) return false;
+    std::string line;
+    while (std::getline(file, line)) {
+        if (line.empty() || line[0] == '#') continue;
+        std::istringstream fields(line);
+        std::string model_name;
+        int size_class, half_precision;
+        Entry entry;
+        if (fields >> model_name >> size_class >> entry.config.threads >>
+            entry.config.tile_workers >> half_precision >> entry.seconds) {
+            entry.config.half_precision = half_precision != 0;
+            entries[{model_name, size_class}] = entry;
+        }
+    }
+    return true;
+}
+
+void DnnTuningProfile::save(const std::string &path) const {
+    std::string temporary = path + ".tmp";
+    {
+        std::ofstream file(temporary);
+        file << "# model size_class threads tile_workers half_precision seconds\n";
+        for (const auto &[key, entry] : entries) {
+            file << key.first << " " << key.second << " " << entry.config.threads << " "
+                 << entry.config.tile_workers << " " << entry.config.half_precision << " "
+                 << entry.seconds << "\n";
+        }
+        if (!file) throw std::runtime_error("Couldn't write DNN profile \"" + temporary + "\"");
+    }
+    if (rename(temporary.c_str(), path.c_str()) != 0) {
+        remove(temporary.c_str());
+        throw std::runtime_error("Couldn't write DNN profile \"" + path + "\"");
+    }
+}
+
+bool DnnTuningProfile::find(const std::string &model_name, int width, int height,
+                            DnnConfig &config) const {
+    int wanted = sizeClass(width, height);
+    const Entry *best = nullptr;
+    int best_distance = 0;
+    for (const auto &[key, entry] : entries) {
+        if (key.first != model_name) continue;
+        int distance = std::abs(key.second - wanted);
+        if (!best || distance < best_distance) {
+            best = &entry;
+            best_distance = distance;
+        }
+    }
+    if (!best) return false;
+    config = best->config;
+    return true;
+}
+
+void DnnTuningProfile::set(const std::string &model_name, int size_class,
+                           const DnnConfig &config, double seconds) {
+    entries[{model_name, size_class}] = {config, seconds};
+}
+
+std::string DnnTuningProfile::describe(const std::string &model_name) const {
+    std::string text;
+    for (const auto &[key, entry] : entries) {
+        if (key.first != model_name) continue;
+        if (!text.empty()) text += ",";
+        text += std::to_string(key.second) + ":" + std::to_string(entry.config.threads) + "/" +
+                std::to_string(entry.config.tile_workers) + "/" +
+                std::to_string(entry.config.half_precision);
+    }
+    return text.empty() ? "default" : text;
+}
+
+bool halfPrecisionSupported() { return upscalerModule().half_precision_supported(); }
+
+static std::vector<DnnConfig> candidateConfigs() {
+    int cores = std::max<int>(std::thread::hardware_concurrency(), 1);
+    std::vector<int> thread_counts;
+    for (int threads = 1; threads < cores; threads *= 2) thread_counts.push_back(threads);
+    thread_counts.push_back(cores);
+
+    std::vector<DnnConfig> configs;
+    for (bool half_precision : {false, true}) {
+        if (half_precision && !halfPrecisionSupported()) continue;
+        for (int workers : {1, 2, 4}) {
+            for (int threads : thread_counts) {
+                if (workers > 1 && threads * workers > cores) continue;
+                configs.push_back({threads, workers, half_precision});
+            }
+        }
+    }
+    return configs;
+}
+
+void tuneModels(const std::string &model_dir, const std::vector<int> &sizes,
+                DnnTuningProfile &profile, std::ostream &log) {
+    std::vector<DnnConfig> configs = candidateConfigs();
+    for (UpscaleMethod method : UpscalerFactory::getAvailableMethods()) {
+        for (int scale = 2; scale <= 8; ++scale) {
+            std::string model_file = modelFileName(method, scale);
+            std::string model_path = model_dir + model_file;
+            struct stat info;
+            if (model_file.empty() || stat(model_path.c_str(), &info) != 0) continue;
+
+            for (int size : sizes) {
+                Image image(size, size);
+                for (int y = 0; y < size; ++y) {
+                    for (int x = 0; x < size; ++x) {
+                        image.setPixel(x, y, rgbPixel(x * 255 / size, y * 255 / size,
+                                                      (x * 7 + y * 13) % 256));
+                    }
+                }
+
+                DnnConfig best_config;
+                double best_seconds = -1;
+                for (const DnnConfig &config : configs) {
+                    if (config.tile_workers > 1 && !UpscalerFactory::supportsBands(method)) {
+                        continue;
+                    }
+                    try {
+                        auto upscaler = UpscalerFactory::createUpscaler(method, model_path);
+                        upscaler->setConfig(config);
+                        // The first run includes network setup, it isn't timed
+                        Image warmup = image;
+                        upscaler->upscale(warmup, scale);
+
+                        double seconds = -1;
+                        for (int run = 0; run < TIMED_RUNS; ++run) {
+                            Image test_image = image;
+                            auto start = std::chrono::high_resolution_clock::now();
+                            upscaler->upscale(test_image, scale);
+                            double elapsed = std::chrono::duration<double>(
+                                                 std::chrono::high_resolution_clock::now() - start)
+                                                 .count();
+                            if (seconds < 0 || elapsed < seconds) seconds = elapsed;
+                        }
+                        log << model_file << " " << size << "x" << size
+                            << ": threads=" << config.threads
+                            << " tile_workers=" << config.tile_workers
+                            << " precision=" << (config.half_precision ? "FP16" : "FP32") << " "
+                            << std::fixed << std::setprecision(2) << seconds * 1000 << " ms"
+                            << std::endl;
+                        if (best_seconds < 0 || seconds < best_seconds) {
+                            best_seconds = seconds;
+                            best_config = config;
+                        }
+                    } catch (const std::exception &e) {
+                        log << model_file << " " << size << "x" << size << ": configuration failed, "
+                            << e.what() << std::endl;
+                    }
+                }
+                if (best_seconds < 0) continue;
+                profile.set(model_file, DnnTuningProfile::sizeClass(size, size), best_config,
+                            best_seconds);
+                log << model_file << " " << size << "x" << size << ": best threads="
+                    << best_config.threads << " tile_workers=" << best_config.tile_workers
+                    << " precision=" << (best_config.half_precision ? "FP16" : "FP32")
+                    << std::endl;
+            }
+        }
+    }
+}
@@ -0,0 +1,54 @@
+#pragma once
+#include <iosfwd>
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+
+// Execution settings of the DNN upscalers. Threads and bands only change the speed, never the
+// pixels; the reduced precision target changes the pixels slightly.
+struct DnnConfig {
+    // OpenCV worker threads, 0 keeps OpenCV's default
+    int threads = 0;
+    // Horizontal bands of the image upscaled concurrently, each by its own network. Ignored
+    // by models whose receptive field is wider than the band overlap.
+    int tile_workers = 1;
+    // Reduced precision CPU target, only used where OpenCV provides it
+    bool half_precision = false;
+};
+
+// Best DnnConfig per model file and input size class, as measured on this machine
+class DnnTuningProfile {
+  public:
+    // $IMAGETOOL_DNN_PROFILE, otherwise dnn_profile.txt in the user cache directory
+    static std::string defaultPath();
+    // Inputs are bucketed by pixel count: up to 128^2, 320^2, 800^2 and above
+    static int sizeClass(int width, int height) noexcept;
+
+    // A missing profile leaves it empty and returns false
+    bool load(const std::string &path);
+    void save(const std::string &path) const;
+
+    // Looks up the configuration for model_name (file name of the model), falling back to
+    // the nearest tuned size class
+    bool find(const std::string &model_name, int width, int height, DnnConfig &config) const;
+    void set(const std::string &model_name, int size_class, const DnnConfig &config,
+             double seconds);
+    // The configurations stored for model_name, as text for cache keys
+    std::string describe(const std::string &model_name) const;
+
+  private:
+    struct Entry {
+        DnnConfig config;
+        double seconds;
+    };
+    std::map<std::pair<std::string, int>, Entry> entries;
+};
+
+// Asks the upscaler module whether its OpenCV has a FP16 CPU target
+bool halfPrecisionSupported();
+
+// Benchmarks thread count, concurrent bands and precision for every known model in
+// model_dir at each of the square input sizes, and records the fastest configurations
+void tuneModels(const std::string &model_dir, const std::vector<int> &sizes,
+                DnnTuningProfile &profile, std::ostream &log);
@@ -1,7 +1,12 @@
 #include "image.h"
 #include "bmp.h"
+#include "convert.h"
+#include "qoi.h"
+#include "y4m.h"
 
+#include <algorithm>
 #include <cstdio>
+#include <cstring>
 #include <stdexcept>
 #include <sys/wait.h>
 
@@ -51,8 +56,55 @@ BMPInfoHeader::BMPInfoHeader(int width, int height)
     imageSize = ((width * sizeof(rgbPixel) + 3) & (~3)) * height;
 }
 
+PixelLayout parsePixelLayout(const std::string &name) {
+    if (name == "packed") return PixelLayout::PACKED;
+    if (name == "bgrx") return PixelLayout::BGRX;
+    if (name == "planar") return PixelLayout::PLANAR;
+    throw std::invalid_argument("Unknown pixel layout: " + name);
+}
+
+const char *pixelLayoutName(PixelLayout layout) noexcept {
+    switch (layout) {
+    case PixelLayout::PACKED:
+        return "packed";
+    case PixelLayout::BGRX:
+        return "bgrx";
+    case PixelLayout::PLANAR:
+        return "planar";
+    }
+    return "unknown";
+}
+
+static int planeCount(PixelLayout layout) noexcept {
+    return layout == PixelLayout::PLANAR ? 3 : 1;
+}
+
+// Bytes of one pixel within a plane
+static int planeChannels(PixelLayout layout) noexcept {
+    return layout == PixelLayout::BGRX ? 4 : 1;
+}
+
+Image::Image(int _width, int _height, PixelLayout _layout)
+    : width(_width), height(_height), is_grayscale(false), layout(_layout), stride(0) {
+    allocate();
+}
+
 Image::~Image() {}
 
+void Image::allocate() {
+    if (layout == PixelLayout::PACKED) {
+        samples = SampleBuffer();
+        stride = 0;
+        pixels.resize(static_cast<size_t>(width) * height);
+        return;
+    }
+    pixels = PixelBuffer();
+    size_t row_bytes = static_cast<size_t>(width) * planeChannels(layout);
+    stride = (row_bytes + PIXEL_ALIGNMENT - 1) / PIXEL_ALIGNMENT * PIXEL_ALIGNMENT;
+    // The padding byte of BGRX stays zero, so whole pixels can be compared
+    samples.assign(stride * height * planeCount(layout), 0);
+}
+
 int Image::getHeight() const noexcept { return height; }
 
 int Image::getWidth() const noexcept { return width; }
@@ -63,19 +115,128 @@ rgbPixel Image::getPixel(int x, int y) {
     if (x < 0 || x >= width || y < 0 || y >= height) {
         throw std::out_of_range("Pixel coordinates out of bounds");
     }
-    return pixels[y * width + x];
+    rgbPixel pixel;
+    return *readPixels(x, y, 1, &pixel);
+}
+
+FILE *openImageFile(const std::string &filename, const char *mode) {
+    bool writing = mode[0] == 'w' || mode[0] == 'a';
+    FILE *file;
+    if (filename == "-") {
+        file = writing ? stdout : stdin;
+    } else {
+        file = fopen(filename.c_str(), mode);
+        if (!file) throw std::runtime_error("Couldn't open file \"" + filename + "\"");
+    }
+    if (writing) setvbuf(file, nullptr, _IOFBF, IO_BUFFER_SIZE);
+    return file;
+}
+
+void closeImageFile(FILE *file) {
+    if (file == stdin) return;
+    if (file == stdout) {
+        fflush(file);
+        return;
+    }
+    fclose(file);
+}
+
+static void skipBytes(FILE *file, long count) {
+    unsigned char buffer[4096];
+    while (count > 0) {
+        size_t chunk = std::min<long>(count, sizeof(buffer));
+        if (fread(buffer, 1, chunk, file) != chunk) {
+            throw std::runtime_error("Unexpected end of file");
+        }
+        count -= chunk;
+    }
+}
+
+void Image::setPixel(int x, int y, rgbPixel pixel) {
+    if (x < 0 || x >= width || y < 0 || y >= height) {
+        throw std::out_of_range("Pixel coordinates out of bounds");
+    }
+    writePixels(x, y, 1, &pixel);
+}
+
+rgbPixel *Image::getRow(int y) noexcept { return &pixels[static_cast<size_t>(y) * width]; }
+
+const rgbPixel *Image::getRow(int y) const noexcept {
+    return &pixels[static_cast<size_t>(y) * width];
+}
+
+const rgbPixel *Image::readPixels(int x, int y, int count, rgbPixel *buffer) const noexcept {
+    if (layout == PixelLayout::PACKED) return &pixels[static_cast<size_t>(y) * width + x];
+    if (layout == PixelLayout::BGRX) {
+        const unsigned char *in = samples.data() + y * stride + 4 * static_cast<size_t>(x);
+        for (int i = 0; i < count; ++i) {
+            buffer[i].b = in[4 * i];
+            buffer[i].g = in[4 * i + 1];
+            buffer[i].r = in[4 * i + 2];
+        }
+        return buffer;
+    }
+    size_t plane = stride * height;
+    const unsigned char *b = samples.data() + y * stride + x, *g = b + plane, *r = g + plane;
+    for (int i = 0; i < count; ++i) {
+        buffer[i].b = b[i];
+        buffer[i].g = g[i];
+        buffer[i].r = r[i];
+    }
+    return buffer;
+}
+
+void Image::writePixels(int x, int y, int count, const rgbPixel *source) noexcept {
+    if (layout == PixelLayout::PACKED) {
+        std::copy_n(source, count, &pixels[static_cast<size_t>(y) * width + x]);
+        return;
+    }
+    if (layout == PixelLayout::BGRX) {
+        unsigned char *out = samples.data() + y * stride + 4 * static_cast<size_t>(x);
+        for (int i = 0; i < count; ++i) {
+            out[4 * i] = source[i].b;
+            out[4 * i + 1] = source[i].g;
+            out[4 * i + 2] = source[i].r;
+        }
+        return;
+    }
+    size_t plane = stride * height;
+    unsigned char *b = samples.data() + y * stride + x, *g = b + plane, *r = g + plane;
+    for (int i = 0; i < count; ++i) {
+        b[i] = source[i].b;
+        g[i] = source[i].g;
+        r[i] = source[i].r;
+    }
+}
+
+PixelLayout Image::getLayout() const noexcept { return layout; }
+
+void Image::setLayout(PixelLayout new_layout) {
+    if (new_layout == layout) return;
+    Image converted(width, height, new_layout);
+    converted.is_grayscale = is_grayscale;
+    std::vector<rgbPixel> row(width);
+    for (int y = 0; y < height; ++y) {
+        converted.writePixels(0, y, width, readPixels(0, y, width, row.data()));
+    }
+    *this = std::move(converted);
+}
+
+SamplePlane Image::getPlane(int index) const noexcept {
+    // The kernels take one plane type for sources and destinations
+    auto data = const_cast<unsigned char *>(samples.data()) + index * stride * height;
+    return {data, stride, width, height, planeChannels(layout)};
 }
 
 void Image::loadImageFromFile(std::string filename, ImageFormat format) {
-    FILE *file = fopen(filename.c_str(), "rb");
-    if (!file) throw std::runtime_error("Couldn't open file \"" + filename + "\"");
+    FILE *file = openImageFile(filename, "rb");
     try {
         loadImage(file, format);
     } catch (const std::exception &e) {
-        fclose(file);
+        closeImageFile(file);
         throw e;
     }
-    fclose(file);
+    closeImageFile(file);
 }
 
 void Image::loadImage(FILE *file, ImageFormat format) {
@@ -83,6 +244,37 @@ void Image::loadImage(FILE *file, ImageFormat format) {
         throw std::runtime_error("Invalid file handle");
     }
 
+    // Rows are decoded straight into PACKED images, the other layouts convert each row
+    std::vector<rgbPixel> packed_row;
+    auto rowToDecode = [&](int y) {
+        if (layout == PixelLayout::PACKED) return &pixels[static_cast<size_t>(y) * width];
+        packed_row.resize(width);
+        return packed_row.data();
+    };
+    auto storeRow = [&](int y) {
+        if (layout != PixelLayout::PACKED) writePixels(0, y, width, packed_row.data());
+    };
+
+    if (format == ImageFormat::Y4M) {
+        Y4MReader reader(file);
+        if (!reader.readFrame(*this)) {
+            throw std::runtime_error("Y4M stream contains no frames");
+        }
+        return;
+    }
+
+    if (format == ImageFormat::QOI) {
+        QOIDecoder decoder(file);
+        width = decoder.getWidth();
+        height = decoder.getHeight();
+        allocate();
+        for (int y = 0; y < height; ++y) {
+            decoder.readRow(rowToDecode(y));
+            storeRow(y);
+        }
+        return;
+    }
+
     if (format == ImageFormat::BMP) {
         BMPHeader bmpHeader;
         BMPInfoHeader bmpInfoHeader;
@@ -96,93 +288,100 @@ void Image::loadImage(FILE *file, ImageFormat format) {
 
         width = bmpInfoHeader.width;
         height = bmpInfoHeader.height;
-        pixels.resize(width * height);
+        allocate();
 
         int rowPadding = (4 - (width * 3) % 4) % 4;
 
-        fseek(file, bmpHeader.dataOffset, SEEK_SET);
+        // Skip forward instead of seeking so that pipes and stdin work too
+        long headersSize = sizeof(BMPHeader) + sizeof(BMPInfoHeader);
+        if (bmpHeader.dataOffset < headersSize) {
+            throw std::runtime_error("Invalid BMP data offset");
+        }
+        skipBytes(file, bmpHeader.dataOffset - headersSize);
 
-        std::vector<unsigned char> rowBuffer(width * 3 + rowPadding);
+        CodecBuffer rowBuffer(width * 3 + rowPadding);
         for (int y = height - 1; y >= 0; y--) {
             if (fread(rowBuffer.data(), 1, width * 3 + rowPadding, file) !=
                 width * 3 + rowPadding) {
                 throw std::runtime_error("Failed to read BMP pixel data: y=" + std::to_string(y));
             }
 
+            rgbPixel *row = rowToDecode(y);
             for (int x = 0; x < width; x++) {
-                int index = y * width + x;
-                pixels[index] = rgbPixel(rowBuffer[x * 3 + 2], // R
-                                         rowBuffer[x * 3 + 1], // G
-                                         rowBuffer[x * 3]      // B
+                row[x] = rgbPixel(rowBuffer[x * 3 + 2], // R
+                                  rowBuffer[x * 3 + 1], // G
+                                  rowBuffer[x * 3]      // B
                 );
             }
+            storeRow(y);
         }
     } else {
-        int yPlaneWidth = width;
-        int yPlaneHeight = height;
-        int heightDivider, widthDivider;
-
-        switch (format) {
-        case ImageFormat::YUV420P:
-            heightDivider = 2;
-            widthDivider = 2;
-            break;
-        case ImageFormat::YUV422P:
-            heightDivider = 1;
-            widthDivider = 2;
-            break;
-        case ImageFormat::YUV444P:
-            heightDivider = 1;
-            widthDivider = 1;
-            break;
-        default:
+        if (!isYUVFormat(format)) {
             throw std::invalid_argument("Unsupported image format");
         }
 
-        int uPlaneWidth = (width + widthDivider - 1) / widthDivider;
-        int uPlaneHeight = (height + heightDivider - 1) / heightDivider;
-        int vPlaneWidth = uPlaneWidth;
-        int vPlaneHeight = uPlaneHeight;
-
-        std::vector<unsigned char> yPlane(yPlaneWidth * yPlaneHeight);
-        std::vector<unsigned char> uPlane(uPlaneWidth * uPlaneHeight);
-        std::vector<unsigned char> vPlane(vPlaneWidth * vPlaneHeight);
-
-        if (fread(yPlane.data(), sizeof(unsigned char), yPlaneWidth * yPlaneHeight, file) !=
-                yPlaneWidth * yPlaneHeight ||
-            fread(uPlane.data(), sizeof(unsigned char), uPlaneWidth * uPlaneHeight, file) !=
-                uPlaneWidth * uPlaneHeight ||
-            fread(vPlane.data(), sizeof(unsigned char), vPlaneWidth * vPlaneHeight, file) !=
-                vPlaneWidth * vPlaneHeight) {
+        CodecBuffer frame(yuvFrameSize(format, width, height));
+        if (fread(frame.data(), 1, frame.size(), file) != frame.size()) {
             throw std::runtime_error("Failed to read YUV data from file");
         }
 
-        pixels.resize(width * height);
+        allocate();
 
+        // Rows are converted straight from the file layout, no planar copy is made
         for (int y = 0; y < height; ++y) {
-            for (int x = 0; x < width; ++x) {
-                yuvPixel yuv(yPlane[y * yPlaneWidth + x],
-                             uPlane[(y / heightDivider) * uPlaneWidth + (x / widthDivider)],
-                             vPlane[(y / heightDivider) * vPlaneWidth + (x / widthDivider)]);
-                pixels[y * width + x] = rgbPixel(yuv);
-            }
+            yuvRowToRgb(yuvRowAt(format, frame.data(), width, height, y), rowToDecode(y), width);
+            storeRow(y);
         }
     }
 }
 
-void Image::saveImageToFile(std::string filename, ImageFormat format) {
-    FILE *file = fopen(filename.c_str(), "wb");
-    if (!file) throw std::runtime_error("Couldn't open file \"" + filename + "\"");
+void Image::saveImageToFile(std::string filename, ImageFormat format) const {
+    FILE *file = openImageFile(filename, "wb");
     try {
         saveImage(file, format);
     } catch (const std::exception &e) {
-        fclose(file);
+        closeImageFile(file);
         throw e;
     }
-    fclose(file);
+    closeImageFile(file);
 }
 
-void Image::saveImage(FILE *file, ImageFormat format) {
+void Image::saveImageToFileAtomically(std::string filename, ImageFormat format) const {
+    if (filename == "-") {
+        throw std::invalid_argument("Atomic writes need a regular output file");
+    }
+    std::string temporary = filename + ".tmp";
+    saveImageToFile(temporary, format);
+    if (rename(temporary.c_str(), filename.c_str()) != 0) {
+        remove(temporary.c_str());
+        throw std::runtime_error("Couldn't replace file \"" + filename + "\"");
+    }
+}
+
+void Image::saveImage(FILE *file, ImageFormat format) const {
+    // Row y as the BMP and QOI encoders take it, gray images are converted into buffer
+    std::vector<unsigned char> gray_row;
+    auto encodedRow = [&](int y, std::vector<rgbPixel> &buffer) {
+        if (!is_grayscale) return readPixels(0, y, width, buffer.data());
+        if (layout == PixelLayout::PACKED) {
+            for (int x = 0; x < width; ++x) {
+                buffer[x] = pixels[static_cast<size_t>(y) * width + x];
+                buffer[x].toGrayScale();
+            }
+            return static_cast<const rgbPixel *>(buffer.data());
+        }
+        gray_row.resize(width);
+        if (layout == PixelLayout::BGRX) {
+            unsigned char *row = getPlane(0).row(y);
+            grayscaleSamples(row, row + 1, row + 2, 4, width, gray_row.data());
+        } else {
+            grayscaleSamples(getPlane(0).row(y), getPlane(1).row(y), getPlane(2).row(y), 1,
+                             width, gray_row.data());
+        }
+        for (int x = 0; x < width; ++x) buffer[x] = rgbPixel(gray_row[x], gray_row[x], gray_row[x]);
+        return static_cast<const rgbPixel *>(buffer.data());
+    };
+
     if (format == ImageFormat::BMP) {
         BMPHeader bmpHeader(width, height);
         BMPInfoHeader bmpInfoHeader(width, height);
@@ -193,58 +392,55 @@ void Image::saveImage(FILE *file, ImageFormat format) {
         int padding_size = (4 - (width * sizeof(rgbPixel) & 0b11)) & 0b11;
         std::vector<rgbPixel> rowBuffer(width);
         for (int y = height - 1; y >= 0; --y) {
-            for (int x = 0; x < width; ++x) {
-                rowBuffer[x] = pixels[y * width + x];
-                if (is_grayscale) rowBuffer[x].toGrayScale();
-            }
-            if (fwrite(rowBuffer.data(), sizeof(rgbPixel), width, file) != width ||
+            if (fwrite(encodedRow(y, rowBuffer), sizeof(rgbPixel), width, file) != width ||
                 fwrite("\0\0\0", 1, padding_size, file) != padding_size)
                 throw std::runtime_error("Couldn't write to file");
         }
         return;
     }
-    if (format != YUV420P && format != YUV422P && format != YUV444P) {
+    if (format == ImageFormat::QOI) {
+        QOIEncoder encoder(file, width, height);
+        std::vector<rgbPixel> rowBuffer(layout == PixelLayout::PACKED && !is_grayscale ? 0 : width);
+        for (int y = 0; y < height; ++y) {
+            encoder.writeRow(encodedRow(y, rowBuffer));
+        }
+        encoder.finish();
+        return;
+    }
+    if (format == ImageFormat::Y4M) {
+        Y4MWriter writer(file);
+        writer.writeFrame(*this);
+        return;
+    }
+    if (!isYUVFormat(format)) {
         throw std::invalid_argument("Unsupported image format");
     }
 
-    int vertical_step = format == ImageFormat::YUV420P ? 2 : 1;
-    int horizontal_step = format == ImageFormat::YUV444P ? 1 : 2;
-
-    std::vector<unsigned char> yPlane(width * height);
-    std::vector<unsigned char> uPlane((width / horizontal_step) * (height / vertical_step));
-    std::vector<unsigned char> vPlane((width / horizontal_step) * (height / vertical_step));
-
+    CodecBuffer frame(yuvFrameSize(format, width, height));
+    std::vector<rgbPixel> rowBuffer(layout == PixelLayout::PACKED ? 0 : width);
     for (int y = 0; y < height; ++y) {
-        for (int x = 0; x < width; ++x) {
-            rgbPixel pixel = rgbPixel(pixels[y * width + x]);
-            if (is_grayscale) pixel.toGrayScale();
-            yuvPixel yuvpixel = yuvPixel(pixel);
-            yPlane[y * width + x] = yuvpixel.y;
-        }
-    }
-
-    for (int y = 0; y < height; y += vertical_step) {
-        for (int x = 0; x < width; x += horizontal_step) {
-            rgbPixel pixel = rgbPixel(pixels[y * width + x]);
-            if (is_grayscale) pixel.toGrayScale();
-            yuvPixel yuvpixel = yuvPixel(pixel);
-            uPlane[(y / vertical_step) * (width / horizontal_step) + (x / horizontal_step)] =
-                yuvpixel.u;
-            vPlane[(y / vertical_step) * (width / horizontal_step) + (x / horizontal_step)] =
-                yuvpixel.v;
-        }
+        rgbRowToYuv(readPixels(0, y, width, rowBuffer.data()), width, is_grayscale,
+                    yuvRowAt(format, frame.data(), width, height, y),
+                    yuvRowHasChroma(format, y));
     }
 
-    if (fwrite(yPlane.data(), 1, yPlane.size(), file) != yPlane.size() ||
-        fwrite(uPlane.data(), 1, uPlane.size(), file) != uPlane.size() ||
-        fwrite(vPlane.data(), 1, vPlane.size(), file) != vPlane.size())
+    if (fwrite(frame.data(), 1, frame.size(), file) != frame.size())
         throw std::runtime_error("Couldn't write to file");
 }
 
 void Image::downSample(const int coefficient) noexcept {
     int newWidth = width / coefficient;
     int newHeight = height / coefficient;
-    std::vector<rgbPixel> new_pixels(newWidth * newHeight);
+    if (layout != PixelLayout::PACKED) {
+        Image result(newWidth, newHeight, layout);
+        result.is_grayscale = is_grayscale;
+        for (int i = 0; i < planeCount(layout); ++i) {
+            boxDownsamplePlane(getPlane(i), result.getPlane(i), coefficient);
+        }
+        *this = std::move(result);
+        return;
+    }
+    PixelBuffer new_pixels(newWidth * newHeight);
 
     for (int y = 0; y < newHeight; ++y) {
         for (int x = 0; x < newWidth; ++x) {
@@ -268,26 +464,58 @@ void Image::downSample(const int coefficient) noexcept {
         }
     }
 
-    pixels = new_pixels;
+    pixels = std::move(new_pixels);
     width = newWidth;
     height = newHeight;
 }
 
+Image Image::halved() const {
+    Image result(width / 2, height / 2, layout);
+    result.is_grayscale = is_grayscale;
+    if (layout != PixelLayout::PACKED) {
+        for (int i = 0; i < planeCount(layout); ++i) {
+            boxDownsamplePlane(getPlane(i), result.getPlane(i), 2);
+        }
+        return result;
+    }
+    for (int y = 0; y < result.height; ++y) {
+        // Channels are averaged as plain bytes, a 2x2 block is 6 bytes wide in each row
+        auto top = reinterpret_cast<const unsigned char *>(&pixels[size_t(2 * y) * width]);
+        auto bottom = top + size_t(width) * sizeof(rgbPixel);
+        auto out = reinterpret_cast<unsigned char *>(&result.pixels[size_t(y) * result.width]);
+        for (int x = 0; x < result.width * 3; x += 3) {
+            for (int c = 0; c < 3; ++c) {
+                int i = 2 * x + c;
+                out[x + c] = (top[i] + top[i + 3] + bottom[i] + bottom[i + 3]) >> 2;
+            }
+        }
+    }
+    return result;
+}
+
 void Image::upSample(const int coefficient) noexcept {
     int new_width = width * coefficient;
     int new_height = height * coefficient;
-    std::vector<rgbPixel> new_pixels(new_width * new_height);
+    if (layout != PixelLayout::PACKED) {
+        Image result(new_width, new_height, layout);
+        result.is_grayscale = is_grayscale;
+        for (int i = 0; i < planeCount(layout); ++i) {
+            bilinearUpsamplePlane(getPlane(i), result.getPlane(i), coefficient);
+        }
+        *this = std::move(result);
+        return;
+    }
+    PixelBuffer new_pixels(new_width * new_height);
 
     for (int y = 0; y < new_height; ++y) {
         for (int x = 0; x < new_width; ++x) {
-            float x_ratio = (float)x / coefficient;
-            float y_ratio = (float)y / coefficient;
+            // Integer split of the position keeps the weights independent of the offset,
+            // so processing a crop gives the same pixels as processing the whole image
+            int x_base = x / coefficient;
+            int y_base = y / coefficient;
 
-            int x_base = (int)x_ratio;
-            int y_base = (int)y_ratio;
-
-            float x_diff = x_ratio - x_base;
-            float y_diff = y_ratio - y_base;
+            float x_diff = (float)(x % coefficient) / coefficient;
+            float y_diff = (float)(y % coefficient) / coefficient;
 
             rgbPixel p1 = pixels[y_base * width + x_base];
             rgbPixel p2 = pixels[y_base * width + std::min(x_base + 1, width - 1)];
@@ -308,9 +536,48 @@ void Image::upSample(const int coefficient) noexcept {
         }
     }
 
-    pixels = new_pixels;
+    pixels = std::move(new_pixels);
     width = new_width;
     height = new_height;
 }
 
 void Image::switchGrayScale() noexcept { is_grayscale = !is_grayscale; }
+
+Image Image::crop(int x, int y, int w, int h) const {
+    if (x < 0 || y < 0 || w < 0 || h < 0 || x + w > width || y + h > height) {
+        throw std::out_of_range("Crop region out of bounds");
+    }
+    Image result(w, h, layout);
+    result.is_grayscale = is_grayscale;
+    result.paste(*this, x, y, 0, 0, w, h);
+    return result;
+}
+
+void Image::paste(const Image &source, int source_x, int source_y, int x, int y, int w, int h) {
+    if (source_x < 0 || source_y < 0 || source_x + w > source.width ||
+        source_y + h > source.height || x < 0 || y < 0 || x + w > width || y + h > height) {
+        throw std::out_of_range("Paste region out of bounds");
+    }
+    if (source.layout != layout) {
+        std::vector<rgbPixel> row(w);
+        for (int i = 0; i < h; ++i) {
+            writePixels(x, y + i, w, source.readPixels(source_x, source_y + i, w, row.data()));
+        }
+        return;
+    }
+    if (layout == PixelLayout::PACKED) {
+        for (int row = 0; row < h; ++row) {
+            std::copy_n(&source.pixels[(source_y + row) * source.width + source_x], w,
+                        &pixels[(y + row) * width + x]);
+        }
+        return;
+    }
+    int channels = planeChannels(layout);
+    for (int i = 0; i < planeCount(layout); ++i) {
+        SamplePlane from = source.getPlane(i), to = getPlane(i);
+        for (int row = 0; row < h; ++row) {
+            memcpy(to.row(y + row) + x * channels, from.row(source_y + row) + source_x * channels,
+                   static_cast<size_t>(w) * channels);
+        }
+    }
+}
@@ -1,4 +1,6 @@
 #pragma once
+#include "memory.h"
+#include "pixel_kernels.h"
 #include <cstdio>
 #include <string>
 #include <vector>
@@ -43,34 +45,108 @@ struct yuvPixel {
 
 #pragma pack(pop)
 
-enum ImageFormat { BMP = 0, YUV420P = 1, YUV422P = 2, YUV444P = 3 };
+using PixelBuffer = std::vector<rgbPixel, TrackedAllocator<rgbPixel, MemoryCategory::PIXELS>>;
+
+// Byte alignment of the rows of the BGRX and PLANAR layouts, one AVX2 register
+constexpr size_t PIXEL_ALIGNMENT = 32;
+using SampleBuffer =
+    std::vector<unsigned char,
+                TrackedAllocator<unsigned char, MemoryCategory::PIXELS, PIXEL_ALIGNMENT>>;
+
+// In-memory pixel layout of an Image. PACKED is the 3-byte BGR pixel the codecs use, BGRX
+// pads every pixel to 4 bytes and PLANAR keeps B, G and R in separate planes; the rows of
+// both start on PIXEL_ALIGNMENT boundaries, so the resamplers and comparisons run on whole
+// vector registers. Codecs convert rows from and to PACKED as they go.
+enum class PixelLayout { PACKED, BGRX, PLANAR };
+
+// Parses "packed", "bgrx" or "planar"
+PixelLayout parsePixelLayout(const std::string &name);
+const char *pixelLayoutName(PixelLayout layout) noexcept;
+
+enum ImageFormat {
+    BMP = 0,
+    YUV420P = 1,
+    YUV422P = 2,
+    YUV444P = 3,
+    Y4M = 4,
+    NV12 = 5,
+    NV21 = 6,
+    YUYV = 7,
+    UYVY = 8,
+    QOI = 9
+};
+
+// Size of the stdio buffer used for output files, so that rows are flushed in large writes
+constexpr size_t IO_BUFFER_SIZE = 1 << 20;
+
+// Opens a file for image I/O, "-" stands for stdin/stdout depending on the mode
+FILE *openImageFile(const std::string &filename, const char *mode);
+void closeImageFile(FILE *file);
 
 class Image {
     friend class TraditionalUpscaler;
     friend class AIUpscaler;
+    friend class TemporalDeduplicator;
+    friend class NativeSRNetwork;
 
   public:
-    Image(int _width = 0, int _height = 0)
-        : width(_width), height(_height), is_grayscale(false), pixels(_width * _height) {}
+    Image(int _width = 0, int _height = 0, PixelLayout _layout = PixelLayout::PACKED);
     ~Image();
+    // Declared explicitly, the user-declared destructor would otherwise turn every move of
+    // the pixel buffer into a copy
+    Image(const Image &) = default;
+    Image(Image &&) noexcept = default;
+    Image &operator=(const Image &) = default;
+    Image &operator=(Image &&) noexcept = default;
 
     int getWidth() const noexcept;
     int getHeight() const noexcept;
     bool isGrayScale() noexcept;
     rgbPixel getPixel(int x, int y);
+    void setPixel(int x, int y, rgbPixel pixel);
+    // Pixels of row y, width entries stored contiguously; PACKED images only
+    rgbPixel *getRow(int y) noexcept;
+    const rgbPixel *getRow(int y) const noexcept;
+    // count pixels of row y from x on as packed BGR. PACKED images return their own storage,
+    // the other layouts convert into buffer, which must hold count pixels.
+    const rgbPixel *readPixels(int x, int y, int count, rgbPixel *buffer) const noexcept;
+    void writePixels(int x, int y, int count, const rgbPixel *source) noexcept;
+
+    PixelLayout getLayout() const noexcept;
+    // Converts the pixels in place
+    void setLayout(PixelLayout new_layout);
+    // Sample plane index of a BGRX (0) or PLANAR (0 to 2, B, G, R) image
+    SamplePlane getPlane(int index) const noexcept;
 
     void loadImage(FILE *file, ImageFormat format);
     void loadImageFromFile(std::string filename, ImageFormat format);
-    void saveImage(FILE *file, ImageFormat format);
-    void saveImageToFile(std::string filename, ImageFormat format);
+    void saveImage(FILE *file, ImageFormat format) const;
+    void saveImageToFile(std::string filename, ImageFormat format) const;
+    // Writes to a temporary file next to filename and renames it into place, so readers
+    // never observe a partially written image
+    void saveImageToFileAtomically(std::string filename, ImageFormat format) const;
 
     void upSample(const int coefficient) noexcept;
     void downSample(const int coefficient) noexcept;
+    // Same result as downSample(2), computed in one pass over pairs of rows
+    Image halved() const;
     void switchGrayScale() noexcept;
 
+    // Copies the w x h region at (x, y), the region must lie inside the image
+    Image crop(int x, int y, int w, int h) const;
+    // Copies the w x h region at (source_x, source_y) of source to (x, y) of this image
+    void paste(const Image &source, int source_x, int source_y, int x, int y, int w, int h);
+
   private:
+    void allocate();
+
     int width;
     int height;
     bool is_grayscale;
-    std::vector<rgbPixel> pixels;
+    PixelLayout layout;
+    // Storage of PACKED images
+    PixelBuffer pixels;
+    // Storage of BGRX and PLANAR images, stride bytes per row of a plane
+    SampleBuffer samples;
+    size_t stride;
 };
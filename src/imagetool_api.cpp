@@ -0,0 +1,504 @@
+#include "imagetool_api.h"
+#include "bmp.h"
+#include "compare.h"
+#include "convert.h"
+#include "image.h"
+#include "qoi.h"
+#include "upscaler.h"
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <new>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+struct imagetool_context {
+    std::string last_error;
+    // Upscaler of the last imagetool_upscale call, reused while method and model stay the same
+    std::unique_ptr<BaseUpscaler> upscaler;
+    std::string upscaler_method;
+    std::string upscaler_model;
+};
+
+namespace {
+
+// Failure with a specific status, other exceptions are mapped by their type
+class ApiError : public std::runtime_error {
+  public:
+    ApiError(imagetool_status status, const std::string &message)
+        : std::runtime_error(message), status(status) {}
+    imagetool_status status;
+};
+
+constexpr size_t QOI_HEADER_AND_PADDING = 14 + 8;
+
+// Runs function and turns any exception into a status code and the context's last error.
+// runtime_status is reported for std::runtime_error, which the codecs and upscalers throw
+// for bad data and failed operations.
+template <typename Function>
+imagetool_status guarded(imagetool_context *context, imagetool_status runtime_status,
+                         Function function) {
+    if (!context) return IMAGETOOL_ERROR_INVALID_ARGUMENT;
+    imagetool_status status;
+    try {
+        function();
+        return IMAGETOOL_OK;
+    } catch (const ApiError &e) {
+        status = e.status;
+        context->last_error = e.what();
+    } catch (const std::invalid_argument &e) {
+        status = IMAGETOOL_ERROR_INVALID_ARGUMENT;
+        context->last_error = e.what();
+    } catch (const std::out_of_range &e) {
+        status = IMAGETOOL_ERROR_INVALID_ARGUMENT;
+        context->last_error = e.what();
+    } catch (const std::bad_alloc &) {
+        status = IMAGETOOL_ERROR_OUT_OF_MEMORY;
+        context->last_error = "Out of memory";
+    } catch (const std::runtime_error &e) {
+        status = runtime_status;
+        context->last_error = e.what();
+    } catch (const std::exception &e) {
+        status = IMAGETOOL_ERROR_INTERNAL;
+        context->last_error = e.what();
+    } catch (...) {
+        status = IMAGETOOL_ERROR_INTERNAL;
+        context->last_error = "Unknown error";
+    }
+    return status;
+}
+
+bool isChromaSubsampledVertically(imagetool_pixel_format format) noexcept {
+    return format == IMAGETOOL_YUV420P || format == IMAGETOOL_NV12 || format == IMAGETOOL_NV21;
+}
+
+int planeCount(imagetool_pixel_format format) noexcept {
+    switch (format) {
+    case IMAGETOOL_BGR24:
+    case IMAGETOOL_YUYV:
+    case IMAGETOOL_UYVY:
+        return 1;
+    case IMAGETOOL_NV12:
+    case IMAGETOOL_NV21:
+        return 2;
+    case IMAGETOOL_YUV420P:
+    case IMAGETOOL_YUV422P:
+    case IMAGETOOL_YUV444P:
+        return 3;
+    default:
+        return 0;
+    }
+}
+
+// Smallest stride of each plane that holds one row
+size_t minimumStride(imagetool_pixel_format format, int plane, int width) noexcept {
+    size_t half_width = (static_cast<size_t>(width) + 1) / 2;
+    switch (format) {
+    case IMAGETOOL_BGR24:
+        return static_cast<size_t>(width) * sizeof(rgbPixel);
+    case IMAGETOOL_YUYV:
+    case IMAGETOOL_UYVY:
+        return 4 * half_width;
+    case IMAGETOOL_NV12:
+    case IMAGETOOL_NV21:
+        return plane == 0 ? width : 2 * half_width;
+    case IMAGETOOL_YUV444P:
+        return width;
+    default:
+        return plane == 0 ? width : half_width;
+    }
+}
+
+int planeHeight(imagetool_pixel_format format, int plane, int height) noexcept {
+    if (plane > 0 && isChromaSubsampledVertically(format)) return (height + 1) / 2;
+    return height;
+}
+
+void validate(const imagetool_image *image) {
+    if (!image) throw std::invalid_argument("Image is NULL");
+    int planes = planeCount(image->format);
+    if (planes == 0) throw ApiError(IMAGETOOL_ERROR_UNSUPPORTED, "Unsupported pixel format");
+    if (image->width <= 0 || image->height <= 0)
+        throw std::invalid_argument("Image dimensions must be positive");
+    for (int plane = 0; plane < planes; ++plane) {
+        if (!image->planes[plane])
+            throw std::invalid_argument("Plane " + std::to_string(plane) + " is NULL");
+        if (image->strides[plane] < 0 ||
+            static_cast<size_t>(image->strides[plane]) <
+                minimumStride(image->format, plane, image->width))
+            throw std::invalid_argument("Stride of plane " + std::to_string(plane) +
+                                        " is smaller than a row");
+    }
+}
+
+// Row y of a YUV view in the form the conversion kernels take
+YUVRow viewRow(const imagetool_image &image, int y) noexcept {
+    int chroma_y = isChromaSubsampledVertically(image.format) ? y / 2 : y;
+    unsigned char *luma = image.planes[0] + static_cast<size_t>(y) * image.strides[0];
+    unsigned char *first = image.planes[1] + static_cast<size_t>(chroma_y) * image.strides[1];
+    switch (image.format) {
+    case IMAGETOOL_YUV420P:
+    case IMAGETOOL_YUV422P:
+    case IMAGETOOL_YUV444P: {
+        unsigned char *v = image.planes[2] + static_cast<size_t>(chroma_y) * image.strides[2];
+        return {luma, 1, first, v, 1, image.format == IMAGETOOL_YUV444P ? 0 : 1};
+    }
+    case IMAGETOOL_NV12:
+        return {luma, 1, first, first + 1, 2, 1};
+    case IMAGETOOL_NV21:
+        return {luma, 1, first + 1, first, 2, 1};
+    case IMAGETOOL_YUYV:
+        return {luma, 2, luma + 1, luma + 3, 4, 1};
+    default: // UYVY
+        return {luma + 1, 2, luma, luma + 2, 4, 1};
+    }
+}
+
+void readRow(const imagetool_image &image, int y, rgbPixel *out) noexcept {
+    if (image.format == IMAGETOOL_BGR24) {
+        memcpy(out, image.planes[0] + static_cast<size_t>(y) * image.strides[0],
+               image.width * sizeof(rgbPixel));
+        return;
+    }
+    yuvRowToRgb(viewRow(image, y), out, image.width);
+}
+
+void writeRow(const imagetool_image &image, int y, const rgbPixel *in) noexcept {
+    if (image.format == IMAGETOOL_BGR24) {
+        memcpy(image.planes[0] + static_cast<size_t>(y) * image.strides[0], in,
+               image.width * sizeof(rgbPixel));
+        return;
+    }
+    bool write_chroma = !isChromaSubsampledVertically(image.format) || y % 2 == 0;
+    rgbRowToYuv(in, image.width, false, viewRow(image, y), write_chroma);
+}
+
+Image toImage(const imagetool_image &view) {
+    Image image(view.width, view.height);
+    for (int y = 0; y < view.height; ++y) readRow(view, y, image.getRow(y));
+    return image;
+}
+
+void fromImage(const Image &image, const imagetool_image &view) {
+    if (image.getWidth() != view.width || image.getHeight() != view.height)
+        throw std::invalid_argument("Destination must be " + std::to_string(image.getWidth()) +
+                                    "x" + std::to_string(image.getHeight()));
+    for (int y = 0; y < view.height; ++y) writeRow(view, y, image.getRow(y));
+}
+
+size_t bmpSize(int width, int height) noexcept {
+    size_t row = (static_cast<size_t>(width) * sizeof(rgbPixel) + 3) & ~size_t(3);
+    return sizeof(BMPHeader) + sizeof(BMPInfoHeader) + row * height;
+}
+
+// Width and height of a 24-bit bottom-up BMP, the only kind Image::loadImage reads
+void bmpDimensions(const unsigned char *data, size_t size, int &width, int &height) {
+    BMPHeader header;
+    BMPInfoHeader info;
+    if (size < sizeof(header) + sizeof(info)) throw std::runtime_error("BMP header is truncated");
+    memcpy(&header, data, sizeof(header));
+    memcpy(&info, data + sizeof(header), sizeof(info));
+    if (header.signature != 0x4D42) throw std::runtime_error("Invalid BMP signature");
+    if (info.bitsPerPixel != 24 || info.compression != 0 || info.width <= 0 || info.height <= 0)
+        throw ApiError(IMAGETOOL_ERROR_UNSUPPORTED,
+                       "Only uncompressed bottom-up 24-bit BMP images are supported");
+    width = info.width;
+    height = info.height;
+}
+
+void qoiDimensions(const unsigned char *data, size_t size, int &width, int &height) {
+    if (size < 14) throw std::runtime_error("QOI header is truncated");
+    if (memcmp(data, "qoif", 4) != 0) throw std::runtime_error("Invalid QOI signature");
+    auto big_endian = [](const unsigned char *p) {
+        return (uint32_t(p[0]) << 24) | (uint32_t(p[1]) << 16) | (uint32_t(p[2]) << 8) | p[3];
+    };
+    uint32_t w = big_endian(data + 4), h = big_endian(data + 8);
+    if (w == 0 || h == 0 || w > INT32_MAX || h > INT32_MAX)
+        throw std::runtime_error("Invalid QOI dimensions");
+    width = w;
+    height = h;
+}
+
+void dimensions(const void *data, size_t size, imagetool_file_format format, int &width,
+                int &height) {
+    if (!data) throw std::invalid_argument("Data is NULL");
+    auto bytes = static_cast<const unsigned char *>(data);
+    if (format == IMAGETOOL_FILE_BMP) return bmpDimensions(bytes, size, width, height);
+    if (format == IMAGETOOL_FILE_QOI) return qoiDimensions(bytes, size, width, height);
+    throw ApiError(IMAGETOOL_ERROR_UNSUPPORTED, "Unsupported file format");
+}
+
+void requireSize(const imagetool_image &image, int width, int height) {
+    if (image.width != width || image.height != height)
+        throw std::invalid_argument("Image must be " + std::to_string(width) + "x" +
+                                    std::to_string(height));
+}
+
+// Memory stream over a caller buffer for the FILE based codecs
+class MemoryFile {
+  public:
+    MemoryFile(void *buffer, size_t size, const char *mode) : file(fmemopen(buffer, size, mode)) {
+        if (!file) throw std::bad_alloc();
+    }
+    ~MemoryFile() {
+        if (file) fclose(file);
+    }
+    FILE *get() const noexcept { return file; }
+
+  private:
+    FILE *file;
+};
+
+} // namespace
+
+extern "C" {
+
+int imagetool_api_version(void) { return IMAGETOOL_API_VERSION; }
+
+imagetool_context *imagetool_context_create(void) {
+    return new (std::nothrow) imagetool_context();
+}
+
+void imagetool_context_destroy(imagetool_context *context) { delete context; }
+
+const char *imagetool_last_error(const imagetool_context *context) {
+    return context ? context->last_error.c_str() : "Context is NULL";
+}
+
+size_t imagetool_buffer_size(imagetool_pixel_format format, int width, int height) {
+    int planes = planeCount(format);
+    if (planes == 0 || width <= 0 || height <= 0) return 0;
+    size_t size = 0;
+    for (int plane = 0; plane < planes; ++plane)
+        size += minimumStride(format, plane, width) * planeHeight(format, plane, height);
+    return size;
+}
+
+imagetool_status imagetool_image_init(imagetool_image *image, imagetool_pixel_format format,
+                                      int width, int height, void *buffer) {
+    size_t size = imagetool_buffer_size(format, width, height);
+    if (!image || !buffer || size == 0) return IMAGETOOL_ERROR_INVALID_ARGUMENT;
+    image->format = format;
+    image->width = width;
+    image->height = height;
+    unsigned char *plane_start = static_cast<unsigned char *>(buffer);
+    for (int plane = 0; plane < 3; ++plane) {
+        if (plane >= planeCount(format)) {
+            image->planes[plane] = nullptr;
+            image->strides[plane] = 0;
+            continue;
+        }
+        size_t stride = minimumStride(format, plane, width);
+        if (stride > INT32_MAX) return IMAGETOOL_ERROR_INVALID_ARGUMENT;
+        image->planes[plane] = plane_start;
+        image->strides[plane] = static_cast<int>(stride);
+        plane_start += stride * planeHeight(format, plane, height);
+    }
+    return IMAGETOOL_OK;
+}
+
+imagetool_status imagetool_probe(imagetool_context *context, const void *data, size_t size,
+                                 imagetool_file_format format, int *width, int *height) {
+    return guarded(context, IMAGETOOL_ERROR_CORRUPT_DATA, [&] {
+        if (!width || !height) throw std::invalid_argument("Width and height must not be NULL");
+        dimensions(data, size, format, *width, *height);
+    });
+}
+
+imagetool_status imagetool_decode(imagetool_context *context, const void *data, size_t size,
+                                  imagetool_file_format format, const imagetool_image *image) {
+    return guarded(context, IMAGETOOL_ERROR_CORRUPT_DATA, [&] {
+        validate(image);
+        int width, height;
+        dimensions(data, size, format, width, height);
+        requireSize(*image, width, height);
+
+        std::vector<rgbPixel> row(width);
+        if (format == IMAGETOOL_FILE_BMP) {
+            // Rows are read straight from the caller's buffer
+            auto bytes = static_cast<const unsigned char *>(data);
+            BMPHeader header;
+            memcpy(&header, bytes, sizeof(header));
+            size_t row_size = (static_cast<size_t>(width) * sizeof(rgbPixel) + 3) & ~size_t(3);
+            if (header.dataOffset < sizeof(BMPHeader) + sizeof(BMPInfoHeader) ||
+                header.dataOffset > size || (size - header.dataOffset) / row_size < size_t(height))
+                throw std::runtime_error("BMP pixel data is truncated");
+            const unsigned char *pixels = bytes + header.dataOffset;
+            for (int y = 0; y < height; ++y) {
+                const unsigned char *source = pixels + (height - 1 - y) * row_size;
+                if (image->format == IMAGETOOL_BGR24) {
+                    memcpy(image->planes[0] + static_cast<size_t>(y) * image->strides[0], source,
+                           width * sizeof(rgbPixel));
+                    continue;
+                }
+                memcpy(row.data(), source, width * sizeof(rgbPixel));
+                writeRow(*image, y, row.data());
+            }
+            return;
+        }
+
+        MemoryFile file(const_cast<void *>(data), size, "rb");
+        QOIDecoder decoder(file.get());
+        for (int y = 0; y < height; ++y) {
+            decoder.readRow(row.data());
+            writeRow(*image, y, row.data());
+        }
+    });
+}
+
+imagetool_status imagetool_encode(imagetool_context *context, const imagetool_image *image,
+                                  imagetool_file_format format, void *buffer, size_t capacity,
+                                  size_t *size) {
+    return guarded(context, IMAGETOOL_ERROR_INTERNAL, [&] {
+        validate(image);
+        if (!size) throw std::invalid_argument("Size must not be NULL");
+        if (format != IMAGETOOL_FILE_BMP && format != IMAGETOOL_FILE_QOI)
+            throw ApiError(IMAGETOOL_ERROR_UNSUPPORTED, "Unsupported file format");
+        int width = image->width, height = image->height;
+        std::vector<rgbPixel> row(width);
+
+        if (format == IMAGETOOL_FILE_BMP) {
+            *size = bmpSize(width, height);
+            if (!buffer || capacity < *size)
+                throw ApiError(IMAGETOOL_ERROR_BUFFER_TOO_SMALL, "Buffer is too small");
+            auto bytes = static_cast<unsigned char *>(buffer);
+            BMPHeader header(width, height);
+            BMPInfoHeader info(width, height);
+            memcpy(bytes, &header, sizeof(header));
+            memcpy(bytes + sizeof(header), &info, sizeof(info));
+            size_t row_size = (static_cast<size_t>(width) * sizeof(rgbPixel) + 3) & ~size_t(3);
+            unsigned char *pixels = bytes + sizeof(header) + sizeof(info);
+            for (int y = 0; y < height; ++y) {
+                unsigned char *target = pixels + (height - 1 - y) * row_size;
+                readRow(*image, y, reinterpret_cast<rgbPixel *>(target));
+                memset(target + width * sizeof(rgbPixel), 0,
+                       row_size - width * sizeof(rgbPixel));
+            }
+            return;
+        }
+
+        // The encoded size is only known afterwards, so the worst case is reported when the
+        // buffer runs out
+        size_t worst_case = QOI_HEADER_AND_PADDING + static_cast<size_t>(width) * height * 4;
+        if (!buffer || capacity == 0) {
+            *size = worst_case;
+            throw ApiError(IMAGETOOL_ERROR_BUFFER_TOO_SMALL, "Buffer is too small");
+        }
+        MemoryFile file(buffer, capacity, "wb");
+        try {
+            QOIEncoder encoder(file.get(), width, height);
+            for (int y = 0; y < height; ++y) {
+                readRow(*image, y, row.data());
+                encoder.writeRow(row.data());
+            }
+            encoder.finish();
+            if (fflush(file.get()) != 0) throw std::runtime_error("Couldn't write to buffer");
+        } catch (const std::runtime_error &) {
+            *size = worst_case;
+            throw ApiError(IMAGETOOL_ERROR_BUFFER_TOO_SMALL, "Buffer is too small");
+        }
+        *size = ftell(file.get());
+    });
+}
+
+imagetool_status imagetool_convert(imagetool_context *context, const imagetool_image *source,
+                                   const imagetool_image *destination) {
+    return guarded(context, IMAGETOOL_ERROR_INTERNAL, [&] {
+        validate(source);
+        validate(destination);
+        requireSize(*destination, source->width, source->height);
+        // One row at a time, the only intermediate is a single BGR row
+        std::vector<rgbPixel> row(source->width);
+        for (int y = 0; y < source->height; ++y) {
+            readRow(*source, y, row.data());
+            writeRow(*destination, y, row.data());
+        }
+    });
+}
+
+imagetool_status imagetool_downsample(imagetool_context *context, const imagetool_image *source,
+                                      int coefficient, const imagetool_image *destination) {
+    return guarded(context, IMAGETOOL_ERROR_INTERNAL, [&] {
+        validate(source);
+        validate(destination);
+        if (coefficient <= 0 || coefficient > source->width || coefficient > source->height)
+            throw std::invalid_argument("Invalid downsample coefficient");
+        requireSize(*destination, source->width / coefficient, source->height / coefficient);
+        // Every output row is the box average of its own band of coefficient source rows, so
+        // only one band is held at a time
+        for (int y = 0; y < destination->height; ++y) {
+            Image rows(source->width, coefficient);
+            for (int row = 0; row < coefficient; ++row) {
+                readRow(*source, y * coefficient + row, rows.getRow(row));
+            }
+            rows.downSample(coefficient);
+            writeRow(*destination, y, rows.getRow(0));
+        }
+    });
+}
+
+imagetool_status imagetool_upsample(imagetool_context *context, const imagetool_image *source,
+                                    int coefficient, const imagetool_image *destination) {
+    return guarded(context, IMAGETOOL_ERROR_INTERNAL, [&] {
+        validate(source);
+        validate(destination);
+        if (coefficient <= 0) throw std::invalid_argument("Invalid upsample coefficient");
+        requireSize(*destination, source->width * coefficient, source->height * coefficient);
+        Image image = toImage(*source);
+        image.upSample(coefficient);
+        fromImage(image, *destination);
+    });
+}
+
+imagetool_status imagetool_upscale(imagetool_context *context, const imagetool_image *source,
+                                   const char *method, const char *model_path, int scale_factor,
+                                   const imagetool_image *destination) {
+    return guarded(context, IMAGETOOL_ERROR_UPSCALER, [&] {
+        validate(source);
+        validate(destination);
+        if (!method) throw std::invalid_argument("Method must not be NULL");
+        if (scale_factor <= 0) throw std::invalid_argument("Invalid scale factor");
+        requireSize(*destination, source->width * scale_factor, source->height * scale_factor);
+
+        std::string model = model_path ? model_path : "";
+        if (!context->upscaler || context->upscaler_method != method ||
+            context->upscaler_model != model) {
+            context->upscaler.reset();
+            context->upscaler = UpscalerFactory::createUpscaler(
+                UpscalerFactory::stringToMethod(method), model);
+            context->upscaler_method = method;
+            context->upscaler_model = model;
+        }
+        Image image = toImage(*source);
+        context->upscaler->upscale(image, scale_factor);
+        fromImage(image, *destination);
+    });
+}
+
+imagetool_status imagetool_compare(imagetool_context *context, const imagetool_image *first,
+                                   const imagetool_image *second, double *mse, double *psnr) {
+    return guarded(context, IMAGETOOL_ERROR_INTERNAL, [&] {
+        validate(first);
+        validate(second);
+        requireSize(*second, first->width, first->height);
+        // Row by row, converted formats never need more than one BGR row per image
+        std::vector<rgbPixel> row1(first->width), row2(first->width);
+        uint64_t sum = 0;
+        for (int y = 0; y < first->height; ++y) {
+            readRow(*first, y, row1.data());
+            readRow(*second, y, row2.data());
+            sum += squaredErrorBytes(reinterpret_cast<const unsigned char *>(row1.data()),
+                                     reinterpret_cast<const unsigned char *>(row2.data()),
+                                     row1.size() * sizeof(rgbPixel));
+        }
+        double error = static_cast<double>(sum) / (static_cast<double>(first->width) *
+                                                   first->height * 3);
+        if (mse) *mse = error;
+        if (psnr) *psnr = ::psnr(error, 255);
+    });
+}
+
+} // extern "C"
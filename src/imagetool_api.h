@@ -0,0 +1,113 @@
+#pragma once
+// C interface to the codecs, resamplers, upscalers and metrics of imageTool.
+//
+// Images are described by caller-owned views: the library reads from and writes to the given
+// planes directly and never keeps a pointer past the call. Every call reports failure through
+// its return code, imagetool_last_error() holds the message of the last failure of a context.
+// Contexts are independent: different threads may use different contexts concurrently, a
+// single context must not be used by two threads at the same time.
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define IMAGETOOL_API_VERSION 1
+
+typedef enum imagetool_status {
+    IMAGETOOL_OK = 0,
+    IMAGETOOL_ERROR_INVALID_ARGUMENT = 1,
+    IMAGETOOL_ERROR_UNSUPPORTED = 2,
+    // The output buffer is too small, the required size has been stored
+    IMAGETOOL_ERROR_BUFFER_TOO_SMALL = 3,
+    IMAGETOOL_ERROR_CORRUPT_DATA = 4,
+    // The upscaler module or model couldn't be loaded or the upscaling failed
+    IMAGETOOL_ERROR_UPSCALER = 5,
+    IMAGETOOL_ERROR_OUT_OF_MEMORY = 6,
+    IMAGETOOL_ERROR_INTERNAL = 7
+} imagetool_status;
+
+typedef enum imagetool_pixel_format {
+    // Packed 8-bit B, G, R, plane 0
+    IMAGETOOL_BGR24 = 0,
+    // Y, U and V in planes 0-2
+    IMAGETOOL_YUV420P = 1,
+    IMAGETOOL_YUV422P = 2,
+    IMAGETOOL_YUV444P = 3,
+    // Y in plane 0, interleaved UV (NV12) or VU (NV21) in plane 1
+    IMAGETOOL_NV12 = 4,
+    IMAGETOOL_NV21 = 5,
+    // Packed 4:2:2 in plane 0
+    IMAGETOOL_YUYV = 6,
+    IMAGETOOL_UYVY = 7
+} imagetool_pixel_format;
+
+typedef enum imagetool_file_format {
+    IMAGETOOL_FILE_BMP = 0,
+    IMAGETOOL_FILE_QOI = 1
+} imagetool_file_format;
+
+typedef struct imagetool_image {
+    imagetool_pixel_format format;
+    int width;
+    int height;
+    unsigned char *planes[3];
+    // Bytes from the start of one row of a plane to the next
+    int strides[3];
+} imagetool_image;
+
+typedef struct imagetool_context imagetool_context;
+
+int imagetool_api_version(void);
+
+// Returns NULL when out of memory
+imagetool_context *imagetool_context_create(void);
+void imagetool_context_destroy(imagetool_context *context);
+// Message of the last failed call on the context, empty if there was none
+const char *imagetool_last_error(const imagetool_context *context);
+
+// Bytes needed for a tightly packed image of the given format and size, 0 if invalid
+size_t imagetool_buffer_size(imagetool_pixel_format format, int width, int height);
+// Fills image with a view of a tightly packed buffer of imagetool_buffer_size() bytes
+imagetool_status imagetool_image_init(imagetool_image *image, imagetool_pixel_format format,
+                                      int width, int height, void *buffer);
+
+// Reads the dimensions from the header of an encoded image
+imagetool_status imagetool_probe(imagetool_context *context, const void *data, size_t size,
+                                 imagetool_file_format format, int *width, int *height);
+// Decodes into image, whose dimensions must match the encoded ones
+imagetool_status imagetool_decode(imagetool_context *context, const void *data, size_t size,
+                                  imagetool_file_format format, const imagetool_image *image);
+// Encodes into buffer. *size receives the encoded size, or the required capacity together
+// with IMAGETOOL_ERROR_BUFFER_TOO_SMALL.
+imagetool_status imagetool_encode(imagetool_context *context, const imagetool_image *image,
+                                  imagetool_file_format format, void *buffer, size_t capacity,
+                                  size_t *size);
+
+// Converts between pixel formats, both images must have the same dimensions
+imagetool_status imagetool_convert(imagetool_context *context, const imagetool_image *source,
+                                   const imagetool_image *destination);
+// Integer factor resampling, destination must be source / coefficient or source * coefficient.
+// Downsampling holds one band of coefficient source rows at a time; upsampling converts the
+// whole source into an internal BGR copy and writes the result from a second one.
+imagetool_status imagetool_downsample(imagetool_context *context, const imagetool_image *source,
+                                      int coefficient, const imagetool_image *destination);
+imagetool_status imagetool_upsample(imagetool_context *context, const imagetool_image *source,
+                                    int coefficient, const imagetool_image *destination);
+// Upscales with one of the --upscale-method methods (model_path may be NULL for the
+// traditional ones). The upscaler is kept in the context and reused while method and
+// model_path stay the same. destination must be source * scale_factor. The upscalers work on
+// whole frames, so the source is copied into an internal BGR image and the result is copied
+// out of one.
+imagetool_status imagetool_upscale(imagetool_context *context, const imagetool_image *source,
+                                   const char *method, const char *model_path, int scale_factor,
+                                   const imagetool_image *destination);
+
+// MSE over all channels and the matching PSNR, the images must have the same dimensions.
+// Compared row by row without copying either image.
+imagetool_status imagetool_compare(imagetool_context *context, const imagetool_image *first,
+                                   const imagetool_image *second, double *mse, double *psnr);
+
+#ifdef __cplusplus
+}
+#endif
@@ -1,8 +1,26 @@
+#include "cache.h"
 #include "compare.h"
+#include "convert.h"
+#include "cost_model.h"
+#include "dedup.h"
+#include "dnn_tuning.h"
 #include "image.h"
+#include "native_sr.h"
+#include "progressive.h"
+#include "shard.h"
 #include "upscaler.h"
+#include "upscaler_module.h"
+#include "y4m.h"
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <deque>
 #include <iostream>
+#include <memory>
+#include <sstream>
 #include <string>
+#include <sys/stat.h>
+#include <thread>
 
 ImageFormat parseImageFormat(std::string format_name) {
     if (format_name == "YUV420P") {
@@ -13,11 +31,94 @@ ImageFormat parseImageFormat(std::string format_name) {
         return ImageFormat::YUV444P;
     } else if (format_name == "BMP") {
         return ImageFormat::BMP;
+    } else if (format_name == "Y4M") {
+        return ImageFormat::Y4M;
+    } else if (format_name == "NV12") {
+        return ImageFormat::NV12;
+    } else if (format_name == "NV21") {
+        return ImageFormat::NV21;
+    } else if (format_name == "YUYV") {
+        return ImageFormat::YUYV;
+    } else if (format_name == "UYVY") {
+        return ImageFormat::UYVY;
+    } else if (format_name == "QOI") {
+        return ImageFormat::QOI;
     } else {
         throw std::invalid_argument("Invalid image format");
     }
 }
 
+// One output of a fan-out run, --output-spec *file*,*format*[,grayscale][,downsample=N][,upsample=N]
+struct OutputSpec {
+    std::string filename;
+    std::string format_name;
+    ImageFormat format;
+    bool grayscale = false;
+    int downsample = 0, upsample = 0;
+};
+
+OutputSpec parseOutputSpec(const std::string &spec) {
+    std::vector<std::string> fields;
+    std::stringstream stream(spec);
+    std::string field;
+    while (std::getline(stream, field, ',')) fields.push_back(field);
+    if (fields.size() < 2) {
+        throw std::invalid_argument("--output-spec must start with <file>,<format>");
+    }
+    OutputSpec output;
+    output.filename = fields[0];
+    output.format_name = fields[1];
+    output.format = parseImageFormat(fields[1]);
+    for (size_t i = 2; i < fields.size(); ++i) {
+        if (fields[i] == "grayscale") {
+            output.grayscale = true;
+        } else if (fields[i].compare(0, 11, "downsample=") == 0) {
+            output.downsample = atoi(fields[i].c_str() + 11);
+            if (output.downsample <= 0) throw std::invalid_argument("Invalid downsample in " + spec);
+        } else if (fields[i].compare(0, 9, "upsample=") == 0) {
+            output.upsample = atoi(fields[i].c_str() + 9);
+            if (output.upsample <= 0) throw std::invalid_argument("Invalid upsample in " + spec);
+        } else {
+            throw std::invalid_argument("Unknown output option \"" + fields[i] + "\"");
+        }
+    }
+    return output;
+}
+
+// Tile sizes tried, largest first, when an upscale doesn't fit into --memory-budget
+static const int BUDGET_TILE_SIZES[] = {512, 256, 128, 64};
+
+static std::string toMegabytes(size_t bytes) {
+    std::ostringstream text;
+    text.precision(1);
+    text << std::fixed << bytes / double(1 << 20);
+    return text.str();
+}
+
+static bool atEndOfFile(FILE *file) {
+    int c = fgetc(file);
+    if (c == EOF) return true;
+    ungetc(c, file);
+    return false;
+}
+
+// Decodes the input of a mode that works on one image, sequences are refused
+static void loadSingleImage(Image &image, const std::string &filename, ImageFormat format,
+                            const std::string &mode) {
+    FILE *file = openImageFile(filename, "rb");
+    try {
+        image.loadImage(file, format);
+        if ((isYUVFormat(format) || format == ImageFormat::Y4M) && !atEndOfFile(file)) {
+            throw std::invalid_argument(mode + " works on single images, the input has more "
+                                               "than one frame");
+        }
+    } catch (...) {
+        closeImageFile(file);
+        throw;
+    }
+    closeImageFile(file);
+}
+
 int main(int argc, char *argv[]) {
     std::string input_filename, output_filename;
     std::string input_format_name, output_format_name;
@@ -28,6 +129,33 @@ int main(int argc, char *argv[]) {
     std::string upscale_method_name, model_path;
     int scale_factor = 2;
     int width = 0, height = 0;
+    std::string cache_dir = ResultCache::directoryFromEnvironment();
+    bool cache_dir_option = false;
+    uint64_t cache_size = ResultCache::DEFAULT_MAX_BYTES;
+    bool no_cache = false;
+    bool dedup = false, progressive = false, calibrate = false, tune = false;
+    std::vector<int> tune_sizes = {96, 224, 512};
+    double deadline_ms = 0;
+    std::string model_dir = "models/", cost_profile_path;
+    double dedup_threshold = 0;
+    int dedup_tile_size = 64, dedup_halo = 16;
+    int batch_size = 1;
+    int workers = 0, shard_frames = 0;
+    // --frames, 0 frames means all of them
+    int range_start = 0, range_frames = 0;
+    std::string manifest_filename, worker_socket;
+    int pyramid_levels = 0;
+    PixelLayout pixel_layout = PixelLayout::PACKED;
+    std::vector<OutputSpec> output_specs;
+    // Approximate --compare, 0 compares every row
+    double sample_fraction = 0, psnr_threshold = 0;
+    uint64_t sample_seed = 1;
+    bool compare_sequences = false;
+    std::string csv_filename;
+    int threads = 0;
+    // --memory-budget in MB, 0 means no budget
+    int memory_budget = 0;
+    bool memory_report = false;
     for (int i = 0; i < argc; i++) {
         if (strcmp(argv[i], "--width") == 0) {
             if (i + 1 >= argc) {
@@ -125,31 +253,628 @@ int main(int argc, char *argv[]) {
                 return 1;
             }
             model_path = argv[i + 1];
+        } else if (strcmp(argv[i], "--cache-dir") == 0) {
+            if (i + 1 >= argc) {
+                std::cerr << "Error: Missing value for --cache-dir" << std::endl;
+                return 1;
+            }
+            cache_dir = argv[i + 1];
+            cache_dir_option = true;
+        } else if (strcmp(argv[i], "--cache-size") == 0) {
+            if (i + 1 >= argc) {
+                std::cerr << "Error: Missing value for --cache-size" << std::endl;
+                return 1;
+            }
+            int megabytes = atoi(argv[i + 1]);
+            if (megabytes <= 0) {
+                std::cerr << "Error: --cache-size must be a positive number of megabytes"
+                          << std::endl;
+                return 1;
+            }
+            cache_size = static_cast<uint64_t>(megabytes) << 20;
+        } else if (strcmp(argv[i], "--no-cache") == 0) {
+            no_cache = true;
+        } else if (strcmp(argv[i], "--deadline-ms") == 0) {
+            if (i + 1 >= argc) {
+                std::cerr << "Error: Missing value for --deadline-ms" << std::endl;
+                return 1;
+            }
+            deadline_ms = atof(argv[i + 1]);
+            if (deadline_ms <= 0) {
+                std::cerr << "Error: --deadline-ms must be positive" << std::endl;
+                return 1;
+            }
+            use_advanced_upscale = true;
+        } else if (strcmp(argv[i], "--model-dir") == 0) {
+            if (i + 1 >= argc) {
+                std::cerr << "Error: Missing value for --model-dir" << std::endl;
+                return 1;
+            }
+            model_dir = argv[i + 1];
+            if (!model_dir.empty() && model_dir.back() != '/') model_dir += '/';
+        } else if (strcmp(argv[i], "--cost-profile") == 0) {
+            if (i + 1 >= argc) {
+                std::cerr << "Error: Missing value for --cost-profile" << std::endl;
+                return 1;
+            }
+            cost_profile_path = argv[i + 1];
+        } else if (strcmp(argv[i], "--calibrate") == 0) {
+            calibrate = true;
+        } else if (strcmp(argv[i], "--tune") == 0) {
+            tune = true;
+        } else if (strcmp(argv[i], "--tune-sizes") == 0) {
+            if (i + 1 >= argc) {
+                std::cerr << "Error: Missing value for --tune-sizes" << std::endl;
+                return 1;
+            }
+            tune_sizes.clear();
+            std::stringstream sizes(argv[i + 1]);
+            std::string size;
+            while (std::getline(sizes, size, ',')) {
+                int value = atoi(size.c_str());
+                if (value <= 0) {
+                    std::cerr << "Error: --tune-sizes must be a list of positive integers"
+                              << std::endl;
+                    return 1;
+                }
+                tune_sizes.push_back(value);
+            }
+        } else if (strcmp(argv[i], "--progressive") == 0) {
+            progressive = true;
+        } else if (strcmp(argv[i], "--dedup") == 0) {
+            dedup = true;
+        } else if (strcmp(argv[i], "--dedup-threshold") == 0) {
+            if (i + 1 >= argc) {
+                std::cerr << "Error: Missing value for --dedup-threshold" << std::endl;
+                return 1;
+            }
+            dedup = true;
+            dedup_threshold = atof(argv[i + 1]);
+            if (dedup_threshold < 0) {
+                std::cerr << "Error: --dedup-threshold must not be negative" << std::endl;
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--dedup-tile") == 0) {
+            if (i + 1 >= argc) {
+                std::cerr << "Error: Missing value for --dedup-tile" << std::endl;
+                return 1;
+            }
+            dedup_tile_size = atoi(argv[i + 1]);
+            if (dedup_tile_size <= 0) {
+                std::cerr << "Error: --dedup-tile must be a positive integer" << std::endl;
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--batch-size") == 0) {
+            if (i + 1 >= argc) {
+                std::cerr << "Error: Missing value for --batch-size" << std::endl;
+                return 1;
+            }
+            batch_size = atoi(argv[i + 1]);
+            if (batch_size <= 0) {
+                std::cerr << "Error: --batch-size must be a positive integer" << std::endl;
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--compare-sequence") == 0) {
+            if (i + 2 >= argc) {
+                std::cerr << "Error: Missing value for --compare-sequence" << std::endl;
+                return 1;
+            }
+            compare_sequences = true;
+            compare_filename1 = argv[i + 1];
+            compare_filename2 = argv[i + 2];
+        } else if (strcmp(argv[i], "--csv") == 0) {
+            if (i + 1 >= argc) {
+                std::cerr << "Error: Missing value for --csv" << std::endl;
+                return 1;
+            }
+            csv_filename = argv[i + 1];
+        } else if (strcmp(argv[i], "--threads") == 0) {
+            if (i + 1 >= argc) {
+                std::cerr << "Error: Missing value for --threads" << std::endl;
+                return 1;
+            }
+            threads = atoi(argv[i + 1]);
+            if (threads <= 0) {
+                std::cerr << "Error: --threads must be a positive integer" << std::endl;
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--memory-budget") == 0) {
+            if (i + 1 >= argc) {
+                std::cerr << "Error: Missing value for --memory-budget" << std::endl;
+                return 1;
+            }
+            memory_budget = atoi(argv[i + 1]);
+            if (memory_budget <= 0) {
+                std::cerr << "Error: --memory-budget must be a positive number of MB" << std::endl;
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--memory-report") == 0) {
+            memory_report = true;
+        } else if (strcmp(argv[i], "--sample-fraction") == 0) {
+            if (i + 1 >= argc) {
+                std::cerr << "Error: Missing value for --sample-fraction" << std::endl;
+                return 1;
+            }
+            sample_fraction = atof(argv[i + 1]);
+            if (sample_fraction <= 0 || sample_fraction > 1) {
+                std::cerr << "Error: --sample-fraction must be in (0, 1]" << std::endl;
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--sample-seed") == 0) {
+            if (i + 1 >= argc) {
+                std::cerr << "Error: Missing value for --sample-seed" << std::endl;
+                return 1;
+            }
+            sample_seed = strtoull(argv[i + 1], nullptr, 10);
+        } else if (strcmp(argv[i], "--psnr-threshold") == 0) {
+            if (i + 1 >= argc) {
+                std::cerr << "Error: Missing value for --psnr-threshold" << std::endl;
+                return 1;
+            }
+            psnr_threshold = atof(argv[i + 1]);
+            if (psnr_threshold <= 0) {
+                std::cerr << "Error: --psnr-threshold must be positive" << std::endl;
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--output-spec") == 0) {
+            if (i + 1 >= argc) {
+                std::cerr << "Error: Missing value for --output-spec" << std::endl;
+                return 1;
+            }
+            try {
+                output_specs.push_back(parseOutputSpec(argv[i + 1]));
+            } catch (const std::exception &e) {
+                std::cerr << "Error: " << e.what() << std::endl;
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--pixel-layout") == 0) {
+            if (i + 1 >= argc) {
+                std::cerr << "Error: Missing value for --pixel-layout" << std::endl;
+                return 1;
+            }
+            try {
+                pixel_layout = parsePixelLayout(argv[i + 1]);
+            } catch (const std::exception &e) {
+                std::cerr << "Error: " << e.what() << std::endl;
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--pyramid") == 0) {
+            if (i + 1 >= argc) {
+                std::cerr << "Error: Missing value for --pyramid" << std::endl;
+                return 1;
+            }
+            pyramid_levels = atoi(argv[i + 1]);
+            if (pyramid_levels <= 0 || pyramid_levels > 16) {
+                std::cerr << "Error: --pyramid must be between 1 and 16" << std::endl;
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--workers") == 0) {
+            if (i + 1 >= argc) {
+                std::cerr << "Error: Missing value for --workers" << std::endl;
+                return 1;
+            }
+            workers = atoi(argv[i + 1]);
+            if (workers <= 0) {
+                std::cerr << "Error: --workers must be a positive integer" << std::endl;
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--shard-frames") == 0) {
+            if (i + 1 >= argc) {
+                std::cerr << "Error: Missing value for --shard-frames" << std::endl;
+                return 1;
+            }
+            shard_frames = atoi(argv[i + 1]);
+            if (shard_frames <= 0) {
+                std::cerr << "Error: --shard-frames must be a positive integer" << std::endl;
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--manifest") == 0) {
+            if (i + 1 >= argc) {
+                std::cerr << "Error: Missing value for --manifest" << std::endl;
+                return 1;
+            }
+            manifest_filename = argv[i + 1];
+        } else if (strcmp(argv[i], "--worker") == 0) {
+            if (i + 1 >= argc) {
+                std::cerr << "Error: Missing value for --worker" << std::endl;
+                return 1;
+            }
+            worker_socket = argv[i + 1];
+        } else if (strcmp(argv[i], "--frames") == 0) {
+            if (i + 1 >= argc) {
+                std::cerr << "Error: Missing value for --frames" << std::endl;
+                return 1;
+            }
+            if (sscanf(argv[i + 1], "%d:%d", &range_start, &range_frames) != 2 ||
+                range_start < 0 || range_frames <= 0) {
+                std::cerr << "Error: --frames must be <first>:<count>" << std::endl;
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--dedup-halo") == 0) {
+            if (i + 1 >= argc) {
+                std::cerr << "Error: Missing value for --dedup-halo" << std::endl;
+                return 1;
+            }
+            dedup_halo = atoi(argv[i + 1]);
+            if (dedup_halo < 0) {
+                std::cerr << "Error: --dedup-halo must not be negative" << std::endl;
+                return 1;
+            }
         }
     }
 
-    if (compare_images) {
+    // First option given that only the per-frame pipeline implements, for the modes that
+    // decode a single image and would otherwise ignore it
+    auto pipelineOnlyOption = [&]() -> std::string {
+        if (use_advanced_upscale || deadline_ms > 0) return "--upscale-method";
+        if (dedup) return "--dedup";
+        if (progressive) return "--progressive";
+        if (range_frames > 0) return "--frames";
+        if (compare_results) return "--compare-results";
+        if (batch_size > 1) return "--batch-size";
+        if (memory_budget || memory_report) return "--memory-budget/--memory-report";
+        if (cache_dir_option) return "--cache-dir";
+        return "";
+    };
+
+    if (!worker_socket.empty()) {
+        try {
+            return runShardWorker(worker_socket);
+        } catch (const std::exception &e) {
+            std::cerr << "Error: " << e.what() << std::endl;
+            return 1;
+        }
+    } else if (workers > 0) {
+        std::ostream &report = output_filename == "-" ? std::cerr : std::cout;
+        try {
+            std::vector<std::string> base_arguments = shardBaseArguments(argc, argv);
+            ShardCoordinator coordinator;
+            bool sequence = manifest_filename.empty();
+            if (sequence) {
+                // A raw YUV file is split into ranges of whole frames, the parts are
+                // concatenated into the output afterwards
+                ImageFormat input_format = parseImageFormat(input_format_name);
+                ImageFormat output_format = parseImageFormat(output_format_name);
+                struct stat input_stat;
+                if (!isYUVFormat(input_format) || !isYUVFormat(output_format) || width == 0 ||
+                    height == 0 || input_filename == "-" || output_filename.empty()) {
+                    throw std::invalid_argument(
+                        "--workers splits raw YUV sequence files into frame ranges, use "
+                        "--manifest for other inputs");
+                }
+                if (stat(input_filename.c_str(), &input_stat) != 0) {
+                    throw std::runtime_error("Couldn't open file \"" + input_filename + "\"");
+                }
+                int frames = input_stat.st_size / yuvFrameSize(input_format, width, height);
+                int per_shard = shard_frames;
+                if (per_shard == 0) {
+                    // A few shards per worker so that a slow or failing worker doesn't hold
+                    // up the end of the job
+                    per_shard = std::max(1, (frames + workers * 4 - 1) / (workers * 4));
+                }
+                for (int first = 0; first < frames; first += per_shard) {
+                    int count = std::min(per_shard, frames - first);
+                    Shard shard;
+                    shard.arguments = base_arguments;
+                    shard.output_filename = coordinator.getDirectory() + "/shard" +
+                                            std::to_string(first) + ".yuv";
+                    shard.arguments.insert(shard.arguments.end(),
+                                           {"--input", input_filename, "--output",
+                                            shard.output_filename, "--frames",
+                                            std::to_string(first) + ":" + std::to_string(count)});
+                    shard.items = count;
+                    shard.description =
+                        "frames " + std::to_string(first) + "-" + std::to_string(first + count - 1);
+                    coordinator.addShard(std::move(shard));
+                }
+            } else {
+                for (const auto &entry : readManifest(manifest_filename)) {
+                    Shard shard;
+                    shard.arguments = base_arguments;
+                    shard.arguments.insert(shard.arguments.end(),
+                                           {"--input", entry.first, "--output", entry.second});
+                    shard.items = 1;
+                    shard.description = entry.first;
+                    coordinator.addShard(std::move(shard));
+                }
+            }
+
+            auto start = std::chrono::steady_clock::now();
+            coordinator.run(workers, report);
+            if (sequence) coordinator.mergeOutputs(output_filename);
+            double seconds =
+                std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+            const char *unit = sequence ? "frames" : "images";
+            int total_items = 0;
+            for (const ShardWorkerStats &stats : coordinator.getStats()) {
+                report << "Worker " << stats.pid << ": " << stats.shards << " shards, "
+                       << stats.items << " " << unit << ", " << stats.failures << " failed, "
+                       << stats.items / std::max(stats.busy_seconds, 1e-9) << " " << unit
+                       << "/s" << std::endl;
+                total_items += stats.items;
+            }
+            report << "Total: " << total_items << " " << unit << " in " << seconds << " s, "
+                   << total_items / std::max(seconds, 1e-9) << " " << unit << "/s" << std::endl;
+        } catch (const std::exception &e) {
+            std::cerr << "Error: " << e.what() << std::endl;
+            return 1;
+        }
+    } else if (calibrate) {
+        try {
+            if (cost_profile_path.empty()) cost_profile_path = CostModel::defaultPath();
+            CostModel cost_model;
+            cost_model.load(cost_profile_path);
+            cost_model.calibrate(model_dir, {2, 3, 4}, std::cout);
+            cost_model.save(cost_profile_path);
+            std::cout << "Cost profile written to " << cost_profile_path << std::endl;
+        } catch (const std::exception &e) {
+            std::cerr << "Error: " << e.what() << std::endl;
+            return 1;
+        }
+    } else if (tune) {
+        try {
+            std::string profile_path = DnnTuningProfile::defaultPath();
+            DnnTuningProfile profile;
+            profile.load(profile_path);
+            tuneModels(model_dir, tune_sizes, profile, std::cout);
+            profile.save(profile_path);
+            std::cout << "DNN profile written to " << profile_path << std::endl;
+        } catch (const std::exception &e) {
+            std::cerr << "Error: " << e.what() << std::endl;
+            return 1;
+        }
+    } else if (compare_sequences) {
+        // Per-frame CSV goes to --csv or stdout, the summary to stdout unless it carries the CSV
+        bool csv_to_stdout = csv_filename.empty() || csv_filename == "-";
+        std::ostream &report = csv_to_stdout ? std::cerr : std::cout;
+        try {
+            ImageFormat format = parseImageFormat(input_format_name);
+            FILE *csv = openImageFile(csv_to_stdout ? "-" : csv_filename, "w");
+            fprintf(csv, "frame,mse_y,mse_u,mse_v,psnr_y,psnr_u,psnr_v\n");
+            PSNRSummary summaries[3];
+            int frames = compareYUVSequences(
+                compare_filename1, compare_filename2, format, width, height, threads,
+                [&](const YUVFrameErrors &errors) {
+                    double values[3];
+                    for (int plane = 0; plane < 3; ++plane) {
+                        values[plane] = psnr(errors.mse[plane], 255);
+                        summaries[plane].add(values[plane]);
+                    }
+                    fprintf(csv, "%d,%.6f,%.6f,%.6f,%.4f,%.4f,%.4f\n", errors.frame,
+                            errors.mse[0], errors.mse[1], errors.mse[2], values[0], values[1],
+                            values[2]);
+                });
+            closeImageFile(csv);
+
+            report << "Compared " << frames << " frames" << std::endl;
+            const char *plane_names[3] = {"Y", "U", "V"};
+            for (int plane = 0; plane < 3; ++plane) {
+                const PSNRSummary &summary = summaries[plane];
+                report << plane_names[plane] << " PSNR: min " << summary.getMin() << ", p5 "
+                       << summary.percentile(5) << ", median " << summary.percentile(50)
+                       << ", p95 " << summary.percentile(95) << ", mean " << summary.getMean()
+                       << ", max " << summary.getMax() << std::endl;
+            }
+        } catch (const std::exception &e) {
+            std::cerr << "Error: " << e.what() << std::endl;
+            return 1;
+        }
+    } else if (compare_images) {
         std::cout << "Comparing images, unrelated parameters ignored" << std::endl;
-        ImageFormat format;
         try {
-            format = parseImageFormat(input_format_name);
+            ImageFormat format = parseImageFormat(input_format_name);
+            // Rows are read on demand, so a sample only touches the rows it compares
+            std::unique_ptr<RowReader> image1 =
+                openRowReader(compare_filename1, format, width, height);
+            std::unique_ptr<RowReader> image2 =
+                openRowReader(compare_filename2, format, width, height);
+
+            MSEEstimate estimate =
+                sample_fraction > 0 ? sampledMSE(*image1, *image2, sample_fraction,
+                                                 ignore_dimensions, sample_seed)
+                                    : rowMSE(*image1, *image2, ignore_dimensions);
+            // PSNR falls as MSE rises, so the bounds swap
+            double psnr_low = psnr(estimate.mse_high, 255), psnr_high = psnr(estimate.mse_low, 255);
+            if (!estimate.exact() && psnr_threshold > 0 && psnr_low <= psnr_threshold &&
+                psnr_threshold <= psnr_high) {
+                std::cout << "Estimated PSNR " << psnr_low << " - " << psnr_high << " from "
+                          << estimate.compared_rows << " of " << estimate.total_rows
+                          << " rows is inconclusive, comparing all rows" << std::endl;
+                estimate = rowMSE(*image1, *image2, ignore_dimensions);
+            }
+
+            std::cout << "MSE: " << estimate.mse;
+            if (!estimate.exact()) {
+                std::cout << " (estimated from " << estimate.compared_rows << " of "
+                          << estimate.total_rows << " rows, 95% CI " << estimate.mse_low << " - "
+                          << estimate.mse_high << ")";
+            }
+            std::cout << std::endl << "PSNR: " << psnr(estimate.mse, 255);
+            if (!estimate.exact()) {
+                std::cout << " (95% CI " << psnr(estimate.mse_high, 255) << " - "
+                          << psnr(estimate.mse_low, 255) << ")";
+            }
+            std::cout << std::endl;
+            if (psnr_threshold > 0) {
+                bool pass = psnr(estimate.mse, 255) >= psnr_threshold;
+                std::cout << "Result: " << (pass ? "PASS" : "FAIL") << " (threshold "
+                          << psnr_threshold << " dB)" << std::endl;
+            }
         } catch (const std::exception &e) {
             std::cerr << "Error: " << e.what() << std::endl;
             return 1;
         }
-        Image image1, image2;
-        image1.loadImageFromFile(compare_filename1, format);
-        image2.loadImageFromFile(compare_filename2, format);
 
+    } else if (pyramid_levels > 0) {
+        // The input is decoded once, every level is halved from the previous one and written
+        // before the next is computed
+        std::ostream &report = output_filename == "-" ? std::cerr : std::cout;
         try {
-            double mse = MSE(image1, image2, ignore_dimensions);
-            std::cout << "MSE: " << mse << std::endl;
-            std::cout << "PSNR: " << psnr(mse, 255) << std::endl;
+            if (output_filename.empty() || output_filename == "-") {
+                throw std::invalid_argument("--pyramid needs an output file name");
+            }
+            std::string unsupported = pipelineOnlyOption();
+            if (unsupported.empty() && (downsample_coefficient || upsample_coefficient)) {
+                unsupported = downsample_coefficient ? "--downsample" : "--upsample";
+            }
+            if (!unsupported.empty()) {
+                throw std::invalid_argument("--pyramid can't be combined with " + unsupported);
+            }
+            ImageFormat input_format = parseImageFormat(input_format_name);
+            ImageFormat output_format = parseImageFormat(output_format_name);
+            Image image(width, height, pixel_layout);
+            loadSingleImage(image, input_filename, input_format, "--pyramid");
+            if (grayscale) image.switchGrayScale();
+
+            size_t extension = output_filename.find_last_of('.');
+            size_t directory_end = output_filename.find_last_of('/');
+            if (extension == std::string::npos ||
+                (directory_end != std::string::npos && extension < directory_end)) {
+                extension = output_filename.size();
+            }
+            for (int level = 1; level <= pyramid_levels; ++level) {
+                if (image.getWidth() < 2 || image.getHeight() < 2) {
+                    report << "Stopping at level " << level - 1 << ", the image is "
+                           << image.getWidth() << "x" << image.getHeight() << std::endl;
+                    break;
+                }
+                image = image.halved();
+                std::string level_filename = output_filename.substr(0, extension) + "_" +
+                                             std::to_string(1 << level) +
+                                             output_filename.substr(extension);
+                image.saveImageToFile(level_filename, output_format);
+                report << "Level 1/" << (1 << level) << ": " << image.getWidth() << "x"
+                       << image.getHeight() << " written to " << level_filename << std::endl;
+            }
         } catch (const std::exception &e) {
             std::cerr << "Error: " << e.what() << std::endl;
             return 1;
         }
+    } else if (!output_specs.empty()) {
+        // Fan-out: the input is decoded once and every output is encoded from the shared image
+        // on its own thread. Outputs with the same grayscale/scale settings share one variant
+        // of the image, and raw YUV outputs of a variant are packed from one YUV444P
+        // conversion instead of converting from RGB for each of them.
+        try {
+            if (!output_filename.empty()) {
+                OutputSpec output;
+                output.filename = output_filename;
+                output.format_name = output_format_name;
+                output.format = parseImageFormat(output_format_name);
+                output.grayscale = grayscale;
+                output.downsample = downsample_coefficient;
+                output.upsample = upsample_coefficient;
+                output_specs.insert(output_specs.begin(), output);
+            }
+            std::string unsupported = pipelineOnlyOption();
+            if (!unsupported.empty()) {
+                throw std::invalid_argument("--output-spec can't be combined with " + unsupported);
+            }
+            int to_stdout = 0;
+            for (const OutputSpec &output : output_specs) to_stdout += output.filename == "-";
+            if (to_stdout > 1) throw std::invalid_argument("Only one output can go to stdout");
+            std::ostream &report = to_stdout ? std::cerr : std::cout;
+
+            Image source(width, height, pixel_layout);
+            loadSingleImage(source, input_filename, parseImageFormat(input_format_name),
+                            "--output-spec");
+
+            struct Variant {
+                bool grayscale = false;
+                int downsample = 0, upsample = 0;
+                Image image;
+                // image, or the source itself when the variant changes nothing
+                const Image *output = nullptr;
+                int yuv_outputs = 0;
+                std::vector<unsigned char> yuv444;
+            };
+            std::vector<Variant> variants;
+            std::vector<size_t> variant_of(output_specs.size());
+            for (size_t i = 0; i < output_specs.size(); ++i) {
+                const OutputSpec &output = output_specs[i];
+                size_t v = 0;
+                while (v < variants.size() &&
+                       (variants[v].grayscale != output.grayscale ||
+                        variants[v].downsample != output.downsample ||
+                        variants[v].upsample != output.upsample)) {
+                    ++v;
+                }
+                if (v == variants.size()) {
+                    Variant variant;
+                    variant.grayscale = output.grayscale;
+                    variant.downsample = output.downsample;
+                    variant.upsample = output.upsample;
+                    variants.push_back(std::move(variant));
+                }
+                variant_of[i] = v;
+                if (isYUVFormat(output.format)) ++variants[v].yuv_outputs;
+            }
+
+            for (Variant &variant : variants) {
+                bool plain = !variant.grayscale && !variant.downsample && !variant.upsample;
+                variant.output = plain ? &source : &variant.image;
+                if (!plain) {
+                    variant.image = source;
+                    if (variant.grayscale) variant.image.switchGrayScale();
+                    if (variant.downsample) variant.image.downSample(variant.downsample);
+                    if (variant.upsample) variant.image.upSample(variant.upsample);
+                }
+                // A single YUV output converts directly, packing only pays off when shared
+                if (variant.yuv_outputs < 2) continue;
+                const Image &image = *variant.output;
+                int w = image.getWidth(), h = image.getHeight();
+                variant.yuv444.resize(yuvFrameSize(ImageFormat::YUV444P, w, h));
+                std::vector<rgbPixel> row(w);
+                for (int y = 0; y < h; ++y) {
+                    rgbRowToYuv(image.readPixels(0, y, w, row.data()), w, variant.grayscale,
+                                yuvRowAt(ImageFormat::YUV444P, variant.yuv444.data(), w, h, y),
+                                true);
+                }
+            }
 
+            std::vector<std::string> errors(output_specs.size());
+            std::vector<std::thread> encoders;
+            for (size_t i = 0; i < output_specs.size(); ++i) {
+                encoders.emplace_back([&, i] {
+                    const OutputSpec &output = output_specs[i];
+                    const Variant &variant = variants[variant_of[i]];
+                    const Image &image = *variant.output;
+                    try {
+                        if (variant.yuv444.empty() || !isYUVFormat(output.format)) {
+                            image.saveImageToFile(output.filename, output.format);
+                            return;
+                        }
+                        int w = image.getWidth(), h = image.getHeight();
+                        std::vector<unsigned char> frame(yuvFrameSize(output.format, w, h));
+                        packYuv444Frame(variant.yuv444.data(), w, h, output.format, frame.data());
+                        FILE *file = openImageFile(output.filename, "wb");
+                        bool written = fwrite(frame.data(), 1, frame.size(), file) == frame.size();
+                        closeImageFile(file);
+                        if (!written) throw std::runtime_error("Couldn't write to file");
+                    } catch (const std::exception &e) {
+                        errors[i] = e.what();
+                    }
+                });
+            }
+            for (std::thread &encoder : encoders) encoder.join();
+
+            bool failed = false;
+            for (size_t i = 0; i < output_specs.size(); ++i) {
+                if (!errors[i].empty()) {
+                    std::cerr << "Error: " << output_specs[i].filename << ": " << errors[i]
+                              << std::endl;
+                    failed = true;
+                    continue;
+                }
+                report << "Written " << output_specs[i].filename << " ("
+                       << output_specs[i].format_name << ")" << std::endl;
+            }
+            if (failed) return 1;
+        } catch (const std::exception &e) {
+            std::cerr << "Error: " << e.what() << std::endl;
+            return 1;
+        }
     } else {
         ImageFormat input_format, output_format;
         try {
@@ -160,7 +885,7 @@ int main(int argc, char *argv[]) {
             return 1;
         }
 
-        if (input_format != ImageFormat::BMP && (width == 0 || height == 0)) {
+        if (isYUVFormat(input_format) && (width == 0 || height == 0)) {
             std::cerr << "Error: YUV formats require width and height provided before conversion"
                       << std::endl;
             return 1;
@@ -174,56 +899,476 @@ int main(int argc, char *argv[]) {
             }
         }
 
-        Image image(width, height);
+        if (progressive && (!use_advanced_upscale || output_filename == "-" || dedup ||
+                            input_format == ImageFormat::Y4M)) {
+            std::cerr << "Error: --progressive needs --upscale-method, a single input image and "
+                         "an output file"
+                      << std::endl;
+            return 1;
+        }
+
+        // Keep stdout clean for image data when writing to a pipe
+        std::ostream &report = output_filename == "-" ? std::cerr : std::cout;
+
+        // Results can only be cached when the whole input is a file that can be hashed
+        // up front and no comparison against the decoded input is requested. With a deadline
+        // the method is chosen from the frame size and the cost profile, which changes after
+        // every run, so the key isn't known up front either.
+        std::unique_ptr<ResultCache> cache;
+        std::string cache_key;
+        if (!cache_dir.empty() && input_filename != "-" && !compare_results && deadline_ms <= 0) {
+            try {
+                cache = std::make_unique<ResultCache>(cache_dir, cache_size);
+                cache_key = "input=" + hashToHex(hashFile(input_filename)) +
+                            " input_format=" + input_format_name + " width=" +
+                            std::to_string(width) + " height=" + std::to_string(height) +
+                            " output_format=" + output_format_name +
+                            " grayscale=" + std::to_string(grayscale) +
+                            " downsample=" + std::to_string(downsample_coefficient) +
+                            " upsample=" + std::to_string(upsample_coefficient) + " dedup=" +
+                            (dedup ? std::to_string(dedup_threshold) + " dedup_tile=" +
+                                         std::to_string(dedup_tile_size) + " dedup_halo=" +
+                                         std::to_string(dedup_halo)
+                                   : "off") +
+                            " progressive=" + std::to_string(progressive);
+                if (range_frames > 0) {
+                    cache_key += " frames=" + std::to_string(range_start) + ":" +
+                                 std::to_string(range_frames);
+                }
+                if (use_advanced_upscale) {
+                    // ESPCN and FSRCNN run on the native engine unless it is disabled; whether
+                    // it accepts a model is fixed by the model file and the module version
+                    UpscaleMethod method = UpscalerFactory::stringToMethod(upscale_method_name);
+                    bool native = (method == UpscaleMethod::ESPCN ||
+                                   method == UpscaleMethod::FSRCNN) &&
+                                  NativeSRNetwork::enabled();
+                    cache_key += " method=" + upscale_method_name +
+                                 " scale=" + std::to_string(scale_factor) + " model=" +
+                                 (model_path.empty() ? "none" : hashToHex(hashFile(model_path))) +
+                                 " engine=" + (native ? "native" : "opencv") +
+                                 " module=" + std::to_string(UPSCALER_MODULE_VERSION);
+                    // The budget picks the tile size, and tile seams change the output
+                    if (memory_budget) {
+                        cache_key += " memory_budget=" + std::to_string(memory_budget);
+                    }
+                    // The tuned configuration of the model is applied on load, and the FP16
+                    // target changes the output
+                    if (!model_path.empty()) {
+                        DnnTuningProfile profile;
+                        profile.load(DnnTuningProfile::defaultPath());
+                        size_t slash = model_path.find_last_of('/');
+                        cache_key += " dnn_profile=" +
+                                     profile.describe(slash == std::string::npos
+                                                          ? model_path
+                                                          : model_path.substr(slash + 1));
+                    }
+                }
+                if (!no_cache && cache->fetch(cache_key, output_filename)) {
+                    CacheStats stats = cache->getStats();
+                    report << "Cache hit, pipeline skipped (hits: " << stats.hits
+                           << ", misses: " << stats.misses << ", evictions: " << stats.evictions
+                           << ")" << std::endl;
+                    return 0;
+                }
+            } catch (const std::exception &e) {
+                std::cerr << "Warning: result cache disabled: " << e.what() << std::endl;
+                cache.reset();
+            }
+        }
+
+        // With a deadline the method is picked once the size of the first frame is known
+        CostModel cost_model;
+        bool update_cost_profile = false;
+        if (use_advanced_upscale) {
+            try {
+                if (cost_profile_path.empty()) cost_profile_path = CostModel::defaultPath();
+                update_cost_profile = cost_model.load(cost_profile_path) || deadline_ms > 0;
+            } catch (const std::exception &e) {
+                std::cerr << "Warning: cost profile unavailable: " << e.what() << std::endl;
+            }
+        }
+
+        std::unique_ptr<BaseUpscaler> upscaler;
+        UpscaleMethod upscale_method = UpscaleMethod::BICUBIC;
+        double upscaler_creation_seconds = 0, last_upscale_seconds = 0;
+        auto createUpscaler = [&](int image_width, int image_height) {
+            UpscaleMethod requested = upscale_method_name.empty()
+                                          ? methodsByQuality().front()
+                                          : UpscalerFactory::stringToMethod(upscale_method_name);
+            upscale_method = requested;
+            std::string method_model_path = model_path;
+            if (deadline_ms > 0) {
+                DeadlineChoice choice =
+                    chooseMethodForDeadline(cost_model, model_dir, requested, image_width,
+                                            image_height, scale_factor, deadline_ms / 1000.0);
+                report << "Deadline " << deadline_ms << " ms for " << image_width << "x"
+                       << image_height << " x" << scale_factor << ":" << std::endl;
+                for (const std::string &line : choice.report) {
+                    report << "  " << line << std::endl;
+                }
+                upscale_method = choice.method;
+                if (choice.method != requested || model_path.empty()) {
+                    method_model_path = choice.model_path;
+                }
+            }
+
+            auto start = std::chrono::high_resolution_clock::now();
+            if (progressive) {
+                // The refiner and its model are loaded on the refinement thread, after the
+                // preview has been written. Every stage replaces the output file atomically,
+                // readers see either the previous stage or the new one.
+                UpscaleMethod method = upscale_method;
+                upscaler = std::make_unique<ProgressiveUpscaler>(
+                    [method, method_model_path]() {
+                        return UpscalerFactory::createUpscaler(method, method_model_path);
+                    },
+                    method,
+                    [&](const Image &stage_image, int stage, bool final) {
+                        stage_image.saveImageToFileAtomically(output_filename, output_format);
+                        report << (stage == 0 ? "Preview" : final ? "Final" : "Refined")
+                               << " stage " << stage << " written to " << output_filename
+                               << std::endl;
+                    });
+            } else {
+                upscaler = UpscalerFactory::createUpscaler(upscale_method, method_model_path);
+            }
+            upscaler_creation_seconds = std::chrono::duration<double>(
+                                            std::chrono::high_resolution_clock::now() - start)
+                                            .count();
+
+            report << "Using " << upscaler->getName() << " upscaler ("
+                   << (upscaler->isAI() ? "AI" : "Traditional") << "), upscaler module loaded in "
+                   << upscalerModuleLoadSeconds() * 1000 << " ms" << std::endl;
+        };
+
+        // Frames are read, processed and written one at a time, so Y4M streams and raw YUV
+        // sequences of any length are converted in constant memory
+        FILE *input_file = nullptr, *output_file = nullptr;
+        auto closeFiles = [&]() {
+            if (input_file) closeImageFile(input_file);
+            if (output_file) closeImageFile(output_file);
+        };
+        std::unique_ptr<Y4MReader> reader;
+        std::unique_ptr<Y4MWriter> writer;
 
         try {
-            image.loadImageFromFile(input_filename, parseImageFormat(input_format_name));
+            input_file = openImageFile(input_filename, "rb");
+            if (input_format == ImageFormat::Y4M) {
+                reader = std::make_unique<Y4MReader>(input_file);
+            }
+            if (range_frames > 0) {
+                if (!isYUVFormat(input_format)) {
+                    throw std::invalid_argument("--frames needs a raw YUV input");
+                }
+                off_t offset = static_cast<off_t>(range_start) *
+                               yuvFrameSize(input_format, width, height);
+                if (fseeko(input_file, offset, SEEK_SET) != 0) {
+                    throw std::runtime_error("--frames needs a seekable input");
+                }
+            }
         } catch (const std::exception &e) {
             std::cerr << "Error: " << e.what() << std::endl;
+            closeFiles();
             return 1;
         }
 
-        Image start_image = image;
+        auto prepare = [&](Image &image) {
+            if (grayscale) {
+                image.switchGrayScale();
+            }
+            if (downsample_coefficient) {
+                image.downSample(downsample_coefficient);
+            }
+            if (upsample_coefficient) {
+                image.upSample(upsample_coefficient);
+            }
+        };
+        auto process = [&](Image &image) {
+            prepare(image);
+            if (upscaler) {
+                auto start = std::chrono::high_resolution_clock::now();
+                upscaler->upscale(image, scale_factor);
+                last_upscale_seconds = std::chrono::duration<double>(
+                                           std::chrono::high_resolution_clock::now() - start)
+                                           .count();
+            }
+        };
+        // Frames of a batch go through the upscaler together, last_upscale_seconds is then
+        // the time per frame
+        auto processBatch = [&](std::vector<Image> &frames) {
+            for (Image &image : frames) prepare(image);
+            if (upscaler) {
+                auto start = std::chrono::high_resolution_clock::now();
+                upscaler->upscale(frames, scale_factor);
+                last_upscale_seconds = std::chrono::duration<double>(
+                                           std::chrono::high_resolution_clock::now() - start)
+                                           .count() /
+                                       frames.size();
+            }
+        };
 
-        if (grayscale) {
-            image.switchGrayScale();
+        std::unique_ptr<TemporalDeduplicator> deduplicator;
+        if (dedup) {
+            int numerator =
+                std::max(upsample_coefficient, 1) * (use_advanced_upscale ? scale_factor : 1);
+            int denominator = std::max(downsample_coefficient, 1);
+            deduplicator = std::make_unique<TemporalDeduplicator>(
+                process, numerator, denominator, dedup_tile_size, dedup_halo, dedup_threshold);
         }
-        if (downsample_coefficient) {
-            image.downSample(downsample_coefficient);
-        }
-        if (upsample_coefficient) {
-            image.upSample(upsample_coefficient);
-        }
-        if (use_advanced_upscale) {
+
+        // Peak of the accounted memory per pipeline stage, for --memory-report
+        MemoryStages stages;
+        // Pixels of a batch of frames through every stage of the pipeline, plus the upscaler's
+        // working memory, known once the first batch is decoded
+        auto estimateMemory = [&](const std::vector<Image> &frames) {
+            size_t count = frames.size();
+            // Row padding of the aligned layouts is left out
+            size_t pixel_bytes = pixel_layout == PixelLayout::BGRX ? 4 : 3;
+            size_t input = pixel_bytes * frames[0].getWidth() * frames[0].getHeight();
+            int prepared_width = frames[0].getWidth() / std::max(downsample_coefficient, 1) *
+                                 std::max(upsample_coefficient, 1);
+            int prepared_height = frames[0].getHeight() / std::max(downsample_coefficient, 1) *
+                                  std::max(upsample_coefficient, 1);
+            size_t prepared = pixel_bytes * prepared_width * prepared_height;
+            int scale = upscaler ? scale_factor : 1;
+            // Upscalers return packed pixels
+            size_t output = upscaler ? 3 * static_cast<size_t>(prepared_width) * prepared_height *
+                                           scale * scale
+                                     : prepared;
+            size_t bytes = count * input * (compare_results ? 2 : 1) +
+                           (prepared != input ? prepared : 0) + count * output;
+            if (upscaler) {
+                bytes += count * upscaler->estimateMemory(prepared_width, prepared_height, scale);
+            }
+            // Raw YUV frames are converted as a whole, other formats row by row
+            if (isYUVFormat(output_format)) bytes += output;
+            // The deduplicator keeps the previous input and output
+            if (dedup) bytes += prepared + output;
+            return bytes;
+        };
+        auto applyMemoryBudget = [&](const std::vector<Image> &frames) {
+            size_t budget = static_cast<size_t>(memory_budget) << 20;
+            size_t estimate = estimateMemory(frames);
+            if (estimate > budget && upscaler && !progressive && !upscaler->getLookahead()) {
+                auto tiled = std::make_unique<TiledUpscaler>(std::move(upscaler),
+                                                             BUDGET_TILE_SIZES[0]);
+                TiledUpscaler &tiles = *tiled;
+                upscaler = std::move(tiled);
+                for (int tile_size : BUDGET_TILE_SIZES) {
+                    tiles.setTileSize(tile_size);
+                    estimate = estimateMemory(frames);
+                    if (estimate <= budget) break;
+                }
+                if (estimate <= budget) {
+                    report << "Memory budget: tiling with " << upscaler->getName() << std::endl;
+                }
+            }
+            if (estimate > budget) {
+                throw std::runtime_error("estimated " + toMegabytes(estimate) +
+                                         " MB exceeds --memory-budget " +
+                                         std::to_string(memory_budget) + " MB");
+            }
+            report << "Memory budget: estimated " << toMegabytes(estimate) << " of "
+                   << memory_budget << " MB" << std::endl;
+        };
+
+        int frames_decoded = 0;
+        auto decodeFrame = [&](Image &image) {
+            if (range_frames > 0 && frames_decoded == range_frames) return false;
+            if (reader) {
+                if (!reader->readFrame(image)) return false;
+            } else if (frames_decoded > 0 &&
+                       (!isYUVFormat(input_format) || atEndOfFile(input_file))) {
+                return false;
+            } else {
+                image.loadImage(input_file, input_format);
+            }
+            ++frames_decoded;
+            return true;
+        };
+        // A temporal upscaler gets every frame through addFrame lookahead frames before it is
+        // upscaled, read_ahead holds the frames decoded for that and not yet processed
+        int lookahead = 0;
+        std::deque<Image> read_ahead;
+        auto announceFrame = [&](const Image &frame) {
+            Image prepared = frame;
+            prepare(prepared);
+            upscaler->addFrame(prepared);
+        };
+        auto fillReadAhead = [&]() {
+            while (static_cast<int>(read_ahead.size()) < lookahead) {
+                Image image(width, height, pixel_layout);
+                if (!decodeFrame(image)) break;
+                announceFrame(image);
+                read_ahead.push_back(std::move(image));
+            }
+        };
+
+        int frames_read = 0;
+        bool end_of_input = false;
+        // Set once the first batch is decoded, the report then labels every frame
+        bool sequence = false;
+        while (!end_of_input) {
+            std::vector<Image> frames;
+            stages.begin("decode");
             try {
-                UpscaleMethod method = UpscalerFactory::stringToMethod(upscale_method_name);
-                auto upscaler = UpscalerFactory::createUpscaler(method, model_path);
+                while (static_cast<int>(frames.size()) < batch_size) {
+                    Image image(width, height, pixel_layout);
+                    if (!read_ahead.empty()) {
+                        image = std::move(read_ahead.front());
+                        read_ahead.pop_front();
+                    } else if (!decodeFrame(image)) {
+                        end_of_input = true;
+                        break;
+                    }
+                    frames.push_back(std::move(image));
+                    ++frames_read;
+                    fillReadAhead();
+                }
+            } catch (const std::exception &e) {
+                std::cerr << "Error: " << e.what() << std::endl;
+                closeFiles();
+                return 1;
+            }
+            stages.end();
+            if (frames.empty()) break;
+            int first_frame = frames_read - static_cast<int>(frames.size());
+            bool more_frames = frames_decoded > 1 || (isYUVFormat(input_format) &&
+                                                      frames_decoded != range_frames &&
+                                                      !atEndOfFile(input_file));
+            if (first_frame == 0) sequence = reader || range_frames > 0 || more_frames;
+            // Every progressive stage replaces the output file, so a sequence is refused
+            // before the first frame's stages overwrite anything
+            if (progressive && more_frames) {
+                std::cerr << "Error: --progressive works on single images only" << std::endl;
+                closeFiles();
+                return 1;
+            }
 
-                std::cout << "Using " << upscaler->getName() << " upscaler ("
-                          << (upscaler->isAI() ? "AI" : "Traditional") << ")" << std::endl;
+            std::vector<Image> start_images;
+            if (compare_results) start_images = frames;
+            int upscale_width = frames[0].getWidth() / std::max(downsample_coefficient, 1) *
+                                std::max(upsample_coefficient, 1);
+            int upscale_height = frames[0].getHeight() / std::max(downsample_coefficient, 1) *
+                                 std::max(upsample_coefficient, 1);
 
-                upscaler->upscale(image, scale_factor);
+            try {
+                if (use_advanced_upscale && !upscaler) {
+                    createUpscaler(upscale_width, upscale_height);
+                }
+                if (memory_budget && first_frame == 0) applyMemoryBudget(frames);
+                // Tiles of the deduplicator and the progressive upscaler aren't sequence frames
+                if (upscaler && first_frame == 0 && !deduplicator && !progressive) {
+                    lookahead = upscaler->getLookahead();
+                    if (lookahead > 0) {
+                        for (const Image &image : frames) announceFrame(image);
+                        fillReadAhead();
+                    }
+                }
+                stages.begin("process");
+                if (deduplicator) {
+                    for (Image &image : frames) deduplicator->processFrame(image);
+                } else if (frames.size() == 1) {
+                    process(frames[0]);
+                } else {
+                    processBatch(frames);
+                }
+                stages.end();
             } catch (const std::exception &e) {
                 std::cerr << "Error during advanced upscaling: " << e.what() << std::endl;
+                closeFiles();
                 return 1;
             }
+
+            // The first frame includes creating the upscaler, like the calibration timings
+            if (first_frame == 0 && upscaler && update_cost_profile && !progressive) {
+                try {
+                    cost_model.observe(upscale_method, upscale_width, upscale_height,
+                                       scale_factor,
+                                       upscaler_creation_seconds + last_upscale_seconds);
+                    cost_model.save(cost_profile_path);
+                } catch (const std::exception &e) {
+                    std::cerr << "Warning: " << e.what() << std::endl;
+                }
+            }
+            stages.begin("encode");
+            for (size_t index = 0; index < frames.size(); ++index) {
+                Image &image = frames[index];
+                int frame = first_frame + static_cast<int>(index);
+                if (compare_results) {
+                    try {
+                        double mse = MSE(start_images[index], image, ignore_dimensions);
+                        if (sequence) report << "Frame " << frame << " ";
+                        report << "MSE: " << mse << std::endl;
+                        if (sequence) report << "Frame " << frame << " ";
+                        report << "PSNR: " << psnr(mse, 255) << std::endl;
+                    } catch (const std::exception &e) {
+                        std::cerr << "Error: " << e.what() << std::endl;
+                        closeFiles();
+                        return 1;
+                    }
+                }
+                try {
+                    if (!output_file && !progressive) {
+                        output_file = openImageFile(output_filename, "wb");
+                        if (output_format == ImageFormat::Y4M) {
+                            writer = std::make_unique<Y4MWriter>(
+                                output_file, reader ? reader->getHeader() : Y4MHeader());
+                        }
+                    }
+                    if (progressive) {
+                        // The final stage has already been written by the progressive upscaler
+                    } else if (writer) {
+                        writer->writeFrame(image);
+                    } else if (frame > 0 && !isYUVFormat(output_format)) {
+                        throw std::runtime_error(
+                            "Multi-frame input requires a YUV or Y4M output format");
+                    } else {
+                        image.saveImage(output_file, output_format);
+                    }
+                } catch (const std::exception &e) {
+                    std::cerr << "Error: " << e.what() << std::endl;
+                    closeFiles();
+                    return 1;
+                }
+            }
+            stages.end();
+        }
+        closeFiles();
+
+        if (memory_report) {
+            report << "Memory peaks:";
+            for (const auto &[stage, bytes] : stages.get()) {
+                report << " " << stage << " " << toMegabytes(bytes) << " MB";
+            }
+            report << std::endl << "Memory by kind:";
+            for (MemoryCategory category :
+                 {MemoryCategory::PIXELS, MemoryCategory::CODEC, MemoryCategory::INFERENCE}) {
+                report << " " << MemoryAccounting::categoryName(category) << " "
+                       << toMegabytes(MemoryAccounting::peak(category)) << " MB";
+            }
+            report << ", accounted " << toMegabytes(MemoryAccounting::peak())
+                   << " MB, process peak " << toMegabytes(MemoryAccounting::processPeak())
+                   << " MB" << std::endl;
+        }
+
+        if (deduplicator) {
+            const DedupStats &stats = deduplicator->getStats();
+            report << "Dedup: reused " << stats.reused_tiles << " of " << stats.tiles << " tiles ("
+                   << 100.0 * stats.reuseRatio() << "%), " << stats.reused_frames << " of "
+                   << stats.frames << " frames unchanged" << std::endl;
         }
-        if (compare_results) {
+
+        if (cache && output_filename != "-") {
             try {
-                double mse = MSE(start_image, image, ignore_dimensions);
-                std::cout << "MSE: " << mse << std::endl;
-                std::cout << "PSNR: " << psnr(mse, 255) << std::endl;
+                cache->store(cache_key, output_filename);
+                CacheStats stats = cache->getStats();
+                report << "Result cached (hits: " << stats.hits << ", misses: " << stats.misses
+                       << ", evictions: " << stats.evictions << ")" << std::endl;
             } catch (const std::exception &e) {
-                std::cerr << "Error: " << e.what() << std::endl;
-                return 1;
+                std::cerr << "Warning: " << e.what() << std::endl;
             }
         }
-        try {
-            image.saveImageToFile(output_filename, output_format);
-        } catch (const std::exception &e) {
-            std::cerr << "Error: " << e.what() << std::endl;
-            return 1;
-        }
     }
     return 0;
 }
@@ -0,0 +1,84 @@
+#include "memory.h"
+
+#include <algorithm>
+#include <atomic>
+#include <fstream>
+#include <sstream>
+
+static std::atomic<size_t> current_bytes[MEMORY_CATEGORIES];
+static std::atomic<size_t> peak_bytes[MEMORY_CATEGORIES];
+static std::atomic<size_t> total_bytes(0), total_peak(0), stage_peak(0);
+
+static void raise(std::atomic<size_t> &mark, size_t value) noexcept {
+    size_t previous = mark.load(std::memory_order_relaxed);
+    while (previous < value && !mark.compare_exchange_weak(previous, value)) {
+    }
+}
+
+void MemoryAccounting::allocate(MemoryCategory category, size_t bytes) noexcept {
+    int index = static_cast<int>(category);
+    raise(peak_bytes[index], current_bytes[index] += bytes);
+    size_t total = total_bytes += bytes;
+    raise(total_peak, total);
+    raise(stage_peak, total);
+}
+
+void MemoryAccounting::release(MemoryCategory category, size_t bytes) noexcept {
+    current_bytes[static_cast<int>(category)] -= bytes;
+    total_bytes -= bytes;
+}
+
+size_t MemoryAccounting::current(MemoryCategory category) noexcept {
+    return current_bytes[static_cast<int>(category)];
+}
+
+size_t MemoryAccounting::current() noexcept { return total_bytes; }
+
+size_t MemoryAccounting::peak(MemoryCategory category) noexcept {
+    return peak_bytes[static_cast<int>(category)];
+}
+
+size_t MemoryAccounting::peak() noexcept { return total_peak; }
+
+void MemoryAccounting::resetStagePeak() noexcept { stage_peak = total_bytes.load(); }
+
+size_t MemoryAccounting::stagePeak() noexcept { return stage_peak; }
+
+size_t MemoryAccounting::processPeak() {
+    std::ifstream status("/proc/self/status");
+    std::string line;
+    while (std::getline(status, line)) {
+        if (line.compare(0, 6, "VmHWM:") != 0) continue;
+        std::istringstream fields(line.substr(6));
+        size_t kilobytes = 0;
+        fields >> kilobytes;
+        return kilobytes * 1024;
+    }
+    return 0;
+}
+
+const char *MemoryAccounting::categoryName(MemoryCategory category) noexcept {
+    switch (category) {
+    case MemoryCategory::PIXELS:
+        return "pixels";
+    case MemoryCategory::CODEC:
+        return "codec";
+    case MemoryCategory::INFERENCE:
+        return "inference";
+    }
+    return "unknown";
+}
+
+void MemoryStages::begin(const std::string &name) {
+    auto stage = std::find_if(stages.begin(), stages.end(),
+                              [&](const auto &entry) { return entry.first == name; });
+    if (stage == stages.end()) stage = stages.insert(stages.end(), {name, 0});
+    active = static_cast<int>(stage - stages.begin());
+    MemoryAccounting::resetStagePeak();
+}
+
+void MemoryStages::end() {
+    if (active < 0) return;
+    stages[active].second = std::max(stages[active].second, MemoryAccounting::stagePeak());
+    active = -1;
+}
@@ -0,0 +1,102 @@
+#pragma once
+#include <cstddef>
+#include <memory>
+#include <new>
+#include <string>
+#include <utility>
+#include <vector>
+
+enum class MemoryCategory { PIXELS = 0, CODEC = 1, INFERENCE = 2 };
+constexpr int MEMORY_CATEGORIES = 3;
+
+// Process-wide accounting of the large buffers: image pixels, codec temporaries and the
+// inference path. Containers report through TrackedAllocator, memory owned by OpenCV is
+// accounted with ScopedMemory estimates. Counters are atomic, any thread may allocate.
+class MemoryAccounting {
+  public:
+    static void allocate(MemoryCategory category, size_t bytes) noexcept;
+    static void release(MemoryCategory category, size_t bytes) noexcept;
+
+    static size_t current(MemoryCategory category) noexcept;
+    static size_t current() noexcept;
+    static size_t peak(MemoryCategory category) noexcept;
+    static size_t peak() noexcept;
+    // Restarts the stage high-water mark at the current total
+    static void resetStagePeak() noexcept;
+    static size_t stagePeak() noexcept;
+    // Peak resident set size of the process (VmHWM), 0 where it isn't available
+    static size_t processPeak();
+    static const char *categoryName(MemoryCategory category) noexcept;
+};
+
+// alignment above the default one is for buffers read with aligned vector loads
+template <typename T, MemoryCategory category, size_t alignment = alignof(T)>
+struct TrackedAllocator {
+    using value_type = T;
+    template <typename U> struct rebind {
+        using other = TrackedAllocator<U, category, alignment>;
+    };
+
+    TrackedAllocator() noexcept = default;
+    template <typename U>
+    TrackedAllocator(const TrackedAllocator<U, category, alignment> &) noexcept {}
+
+    T *allocate(size_t n) {
+        T *p;
+        if (alignment > __STDCPP_DEFAULT_NEW_ALIGNMENT__) {
+            p = static_cast<T *>(::operator new(n * sizeof(T), std::align_val_t(alignment)));
+        } else {
+            p = std::allocator<T>().allocate(n);
+        }
+        MemoryAccounting::allocate(category, n * sizeof(T));
+        return p;
+    }
+    void deallocate(T *p, size_t n) noexcept {
+        MemoryAccounting::release(category, n * sizeof(T));
+        if (alignment > __STDCPP_DEFAULT_NEW_ALIGNMENT__) {
+            ::operator delete(p, std::align_val_t(alignment));
+        } else {
+            std::allocator<T>().deallocate(p, n);
+        }
+    }
+    template <typename U>
+    bool operator==(const TrackedAllocator<U, category, alignment> &) const noexcept {
+        return true;
+    }
+    template <typename U>
+    bool operator!=(const TrackedAllocator<U, category, alignment> &) const noexcept {
+        return false;
+    }
+};
+
+using CodecBuffer = std::vector<unsigned char, TrackedAllocator<unsigned char, MemoryCategory::CODEC>>;
+using InferenceBuffer = std::vector<float, TrackedAllocator<float, MemoryCategory::INFERENCE>>;
+
+// Accounts bytes for the lifetime of the object, for buffers allocated by libraries
+class ScopedMemory {
+  public:
+    ScopedMemory(MemoryCategory category, size_t bytes) noexcept
+        : category(category), bytes(bytes) {
+        MemoryAccounting::allocate(category, bytes);
+    }
+    ~ScopedMemory() { MemoryAccounting::release(category, bytes); }
+    ScopedMemory(const ScopedMemory &) = delete;
+    ScopedMemory &operator=(const ScopedMemory &) = delete;
+
+  private:
+    MemoryCategory category;
+    size_t bytes;
+};
+
+// High-water marks of named pipeline stages. A stage that runs again, e.g. once per frame,
+// keeps the largest mark; stages are listed in the order they first ran.
+class MemoryStages {
+  public:
+    void begin(const std::string &name);
+    void end();
+    const std::vector<std::pair<std::string, size_t>> &get() const noexcept { return stages; }
+
+  private:
+    std::vector<std::pair<std::string, size_t>> stages;
+    int active = -1;
+};
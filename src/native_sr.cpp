@@ -0,0 +1,719 @@
+#include "native_sr.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdlib>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <map>
+#include <stdexcept>
+#include <thread>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define NATIVE_SR_X86 1
+#endif
+
+// Output tile side in input pixels, a tile with its context and 64 channels stays in L2
+static constexpr int TILE_SIZE = 64;
+static constexpr int MIN_TILE_SIZE = 16;
+// Output channels are processed in groups of SIMD_WIDTH, pixels in groups of PIXEL_BLOCK
+static constexpr int SIMD_WIDTH = 8;
+static constexpr int PIXEL_BLOCK = 4;
+
+namespace {
+
+// Just enough of the protobuf wire format to walk a TensorFlow GraphDef
+class ProtoReader {
+  public:
+    ProtoReader(const unsigned char *data, size_t size) : pos(data), end(data + size) {}
+
+    bool atEnd() const noexcept { return pos >= end; }
+
+    uint64_t varint() {
+        uint64_t value = 0;
+        for (int shift = 0; shift < 64; shift += 7) {
+            if (pos >= end) break;
+            unsigned char byte = *pos++;
+            value |= static_cast<uint64_t>(byte & 0x7f) << shift;
+            if (!(byte & 0x80)) return value;
+        }
+        throw std::runtime_error("Malformed model file");
+    }
+
+    int field(int &wire_type) {
+        uint64_t key = varint();
+        wire_type = key & 7;
+        return static_cast<int>(key >> 3);
+    }
+
+    ProtoReader message() {
+        uint64_t size = varint();
+        if (size > static_cast<uint64_t>(end - pos)) throw std::runtime_error("Malformed model file");
+        ProtoReader reader(pos, size);
+        pos += size;
+        return reader;
+    }
+
+    std::string string() {
+        ProtoReader reader = message();
+        return std::string(reinterpret_cast<const char *>(reader.pos), reader.end - reader.pos);
+    }
+
+    float fixed32() {
+        if (end - pos < 4) throw std::runtime_error("Malformed model file");
+        float value;
+        memcpy(&value, pos, sizeof(value));
+        pos += 4;
+        return value;
+    }
+
+    void skip(int wire_type) {
+        switch (wire_type) {
+        case 0:
+            varint();
+            break;
+        case 1:
+            if (end - pos < 8) throw std::runtime_error("Malformed model file");
+            pos += 8;
+            break;
+        case 2:
+            message();
+            break;
+        case 5:
+            fixed32();
+            break;
+        default:
+            throw std::runtime_error("Malformed model file");
+        }
+    }
+
+    const unsigned char *pos, *end;
+};
+
+struct Tensor {
+    std::vector<int> shape;
+    std::vector<float> values;
+};
+
+struct GraphNode {
+    std::string name, op, padding;
+    std::vector<std::string> inputs;
+    bool has_value = false;
+    Tensor value;
+    int block_size = 0;
+};
+
+constexpr int DT_FLOAT = 1;
+
+Tensor parseTensor(ProtoReader reader, bool &is_float) {
+    Tensor tensor;
+    is_float = false;
+    while (!reader.atEnd()) {
+        int wire_type;
+        int field = reader.field(wire_type);
+        if (field == 1 && wire_type == 0) {
+            is_float = reader.varint() == DT_FLOAT;
+        } else if (field == 2 && wire_type == 2) {
+            ProtoReader shape = reader.message();
+            while (!shape.atEnd()) {
+                int dim_wire;
+                if (shape.field(dim_wire) != 2 || dim_wire != 2) {
+                    shape.skip(dim_wire);
+                    continue;
+                }
+                ProtoReader dim = shape.message();
+                int size = 0;
+                while (!dim.atEnd()) {
+                    int size_wire;
+                    if (dim.field(size_wire) == 1 && size_wire == 0) {
+                        size = static_cast<int>(dim.varint());
+                    } else {
+                        dim.skip(size_wire);
+                    }
+                }
+                tensor.shape.push_back(size);
+            }
+        } else if (field == 4 && wire_type == 2) {
+            ProtoReader content = reader.message();
+            size_t count = (content.end - content.pos) / sizeof(float);
+            tensor.values.resize(count);
+            memcpy(tensor.values.data(), content.pos, count * sizeof(float));
+        } else if (field == 5 && wire_type == 2) {
+            ProtoReader packed = reader.message();
+            while (!packed.atEnd()) tensor.values.push_back(packed.fixed32());
+        } else if (field == 5 && wire_type == 5) {
+            tensor.values.push_back(reader.fixed32());
+        } else {
+            reader.skip(wire_type);
+        }
+    }
+
+    size_t count = 1;
+    for (int size : tensor.shape) count *= size;
+    // TensorFlow stores constant-filled tensors as a single value
+    if (tensor.values.size() == 1 && count > 1) tensor.values.resize(count, tensor.values[0]);
+    if (is_float && tensor.values.size() != count) throw std::runtime_error("Malformed model file");
+    return tensor;
+}
+
+GraphNode parseNode(ProtoReader reader) {
+    GraphNode node;
+    while (!reader.atEnd()) {
+        int wire_type;
+        int field = reader.field(wire_type);
+        if (wire_type != 2) {
+            reader.skip(wire_type);
+        } else if (field == 1) {
+            node.name = reader.string();
+        } else if (field == 2) {
+            node.op = reader.string();
+        } else if (field == 3) {
+            node.inputs.push_back(reader.string());
+        } else if (field == 5) {
+            ProtoReader entry = reader.message();
+            std::string key;
+            ProtoReader value(nullptr, 0);
+            while (!entry.atEnd()) {
+                int entry_wire;
+                int entry_field = entry.field(entry_wire);
+                if (entry_field == 1 && entry_wire == 2) {
+                    key = entry.string();
+                } else if (entry_field == 2 && entry_wire == 2) {
+                    value = entry.message();
+                } else {
+                    entry.skip(entry_wire);
+                }
+            }
+            while (!value.atEnd()) {
+                int value_wire;
+                int value_field = value.field(value_wire);
+                if (key == "value" && value_field == 8 && value_wire == 2) {
+                    node.value = parseTensor(value.message(), node.has_value);
+                } else if (key == "block_size" && value_field == 3 && value_wire == 0) {
+                    node.block_size = static_cast<int>(value.varint());
+                } else if (key == "padding" && value_field == 2 && value_wire == 2) {
+                    node.padding = value.string();
+                } else {
+                    value.skip(value_wire);
+                }
+            }
+        } else {
+            reader.skip(wire_type);
+        }
+    }
+    return node;
+}
+
+inline int descale(int value) { return (value + (1 << 13)) >> 14; }
+
+inline unsigned char saturate(int value) {
+    return static_cast<unsigned char>(std::min(std::max(value, 0), 255));
+}
+
+// Fixed point BGR <-> YCrCb with the coefficients of OpenCV's cvtColor for 8-bit images
+inline void bgrToYCrCb(const rgbPixel &pixel, int &y, int &cr, int &cb) {
+    y = descale(pixel.b * 1868 + pixel.g * 9617 + pixel.r * 4899);
+    cr = saturate(descale((pixel.r - y) * 11682) + 128);
+    cb = saturate(descale((pixel.b - y) * 9241) + 128);
+}
+
+inline rgbPixel yCrCbToBgr(int y, int cr, int cb) {
+    cr -= 128;
+    cb -= 128;
+    return rgbPixel(saturate(y + descale(cr * 22987)),
+                    saturate(y + descale(cb * -5636 + cr * -11698)),
+                    saturate(y + descale(cb * 29049)));
+}
+
+// Sample positions and weights of a bilinear resize by an integer factor, pixel centers
+// aligned like cv::resize with INTER_LINEAR
+void bilinearCoefficients(int source_size, int scale, std::vector<int> &index,
+                          std::vector<float> &weight) {
+    index.resize(source_size * scale);
+    weight.resize(source_size * scale);
+    for (int i = 0; i < source_size * scale; ++i) {
+        float position = (i + 0.5f) / scale - 0.5f;
+        int left = static_cast<int>(std::floor(position));
+        float fraction = position - left;
+        if (left < 0) {
+            left = 0;
+            fraction = 0;
+        }
+        if (left >= source_size - 1) {
+            left = source_size - 1;
+            fraction = 0;
+        }
+        index[i] = left;
+        weight[i] = fraction;
+    }
+}
+
+struct ConvParams {
+    const float *weights, *bias, *negative_slope;
+    int kernel_size, in_channels, out_channels;
+};
+
+// Input and output are (height + 2 * pad) x (width + 2 * pad) pixel grids with interleaved
+// channels, only the inner width x height pixels are computed. width is a multiple of
+// PIXEL_BLOCK, out_channels of SIMD_WIDTH.
+void convolveScalar(const ConvParams &params, const float *input, float *output, int width,
+                    int height, int pad) {
+    int stride = width + 2 * pad;
+    int offset = pad - params.kernel_size / 2;
+    int in_channels = params.in_channels, out_channels = params.out_channels;
+    std::vector<float> sums(out_channels);
+    for (int y = 0; y < height; ++y) {
+        for (int x = 0; x < width; ++x) {
+            std::copy(params.bias, params.bias + out_channels, sums.begin());
+            for (int ky = 0; ky < params.kernel_size; ++ky) {
+                for (int kx = 0; kx < params.kernel_size; ++kx) {
+                    const float *in =
+                        input + ((y + offset + ky) * stride + x + offset + kx) * in_channels;
+                    const float *w =
+                        params.weights + (ky * params.kernel_size + kx) * in_channels * out_channels;
+                    for (int ci = 0; ci < in_channels; ++ci) {
+                        float value = in[ci];
+                        const float *w_row = w + ci * out_channels;
+                        for (int co = 0; co < out_channels; ++co) sums[co] += value * w_row[co];
+                    }
+                }
+            }
+            float *out = output + ((y + pad) * stride + x + pad) * out_channels;
+            for (int co = 0; co < out_channels; ++co) {
+                float sum = sums[co];
+                out[co] = sum > 0 ? sum : sum * params.negative_slope[co];
+            }
+        }
+    }
+}
+
+#ifdef NATIVE_SR_X86
+// PIXEL_BLOCK neighbouring pixels x CHUNKS * SIMD_WIDTH output channels per call, the
+// accumulators stay in registers for the whole kernel window
+template <int CHUNKS>
+__attribute__((target("avx2,fma"))) inline void
+convolveBlockAVX2(const ConvParams &params, const float *input, float *output, int stride,
+                  int offset, int pad, int x, int y, int co) {
+    int in_channels = params.in_channels, out_channels = params.out_channels;
+    __m256 sums[PIXEL_BLOCK][CHUNKS];
+    for (int c = 0; c < CHUNKS; ++c) {
+        __m256 bias = _mm256_loadu_ps(params.bias + co + c * SIMD_WIDTH);
+        for (int p = 0; p < PIXEL_BLOCK; ++p) sums[p][c] = bias;
+    }
+    for (int ky = 0; ky < params.kernel_size; ++ky) {
+        for (int kx = 0; kx < params.kernel_size; ++kx) {
+            const float *in = input + ((y + offset + ky) * stride + x + offset + kx) * in_channels;
+            const float *w = params.weights +
+                             (ky * params.kernel_size + kx) * in_channels * out_channels + co;
+            for (int ci = 0; ci < in_channels; ++ci) {
+                __m256 weights[CHUNKS];
+                for (int c = 0; c < CHUNKS; ++c) {
+                    weights[c] = _mm256_loadu_ps(w + ci * out_channels + c * SIMD_WIDTH);
+                }
+                for (int p = 0; p < PIXEL_BLOCK; ++p) {
+                    __m256 value = _mm256_broadcast_ss(in + p * in_channels + ci);
+                    for (int c = 0; c < CHUNKS; ++c) {
+                        sums[p][c] = _mm256_fmadd_ps(value, weights[c], sums[p][c]);
+                    }
+                }
+            }
+        }
+    }
+    __m256 zero = _mm256_setzero_ps();
+    for (int c = 0; c < CHUNKS; ++c) {
+        __m256 slope = _mm256_loadu_ps(params.negative_slope + co + c * SIMD_WIDTH);
+        for (int p = 0; p < PIXEL_BLOCK; ++p) {
+            __m256 activated = _mm256_fmadd_ps(slope, _mm256_min_ps(sums[p][c], zero),
+                                               _mm256_max_ps(sums[p][c], zero));
+            _mm256_storeu_ps(output + ((y + pad) * stride + x + p + pad) * out_channels + co +
+                                 c * SIMD_WIDTH,
+                             activated);
+        }
+    }
+}
+
+__attribute__((target("avx2,fma"))) void convolveAVX2(const ConvParams &params,
+                                                      const float *input, float *output,
+                                                      int width, int height, int pad) {
+    int stride = width + 2 * pad;
+    int offset = pad - params.kernel_size / 2;
+    for (int y = 0; y < height; ++y) {
+        for (int x = 0; x < width; x += PIXEL_BLOCK) {
+            // 12 of the 16 vector registers hold accumulators
+            int co = 0;
+            for (; co + 3 * SIMD_WIDTH <= params.out_channels; co += 3 * SIMD_WIDTH) {
+                convolveBlockAVX2<3>(params, input, output, stride, offset, pad, x, y, co);
+            }
+            if (params.out_channels - co == 2 * SIMD_WIDTH) {
+                convolveBlockAVX2<2>(params, input, output, stride, offset, pad, x, y, co);
+            } else if (co < params.out_channels) {
+                convolveBlockAVX2<1>(params, input, output, stride, offset, pad, x, y, co);
+            }
+        }
+    }
+}
+#endif
+
+using ConvolveFunction = void (*)(const ConvParams &, const float *, float *, int, int, int);
+
+ConvolveFunction selectConvolution() {
+#ifdef NATIVE_SR_X86
+    if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) return convolveAVX2;
+#endif
+    return convolveScalar;
+}
+
+// Zeroes everything of a padded grid outside the inner [x0, x1) x [y0, y1) range, these are
+// the zero paddings of TensorFlow's SAME convolution
+void clearOutside(float *buffer, int width, int height, int pad, int channels, int x0, int x1,
+                  int y0, int y1) {
+    int stride = width + 2 * pad;
+    for (int y = 0; y < height + 2 * pad; ++y) {
+        float *row = buffer + y * stride * channels;
+        if (y < y0 + pad || y >= y1 + pad) {
+            std::fill(row, row + stride * channels, 0.0f);
+            continue;
+        }
+        std::fill(row, row + (x0 + pad) * channels, 0.0f);
+        std::fill(row + (x1 + pad) * channels, row + stride * channels, 0.0f);
+    }
+}
+
+int roundUp(int value, int multiple) { return (value + multiple - 1) / multiple * multiple; }
+
+} // namespace
+
+bool NativeSRNetwork::enabled() {
+    const char *setting = getenv("IMAGETOOL_NATIVE_DNN");
+    return !setting || strcmp(setting, "0") != 0;
+}
+
+void NativeSRNetwork::load(const std::string &path) {
+    std::ifstream file(path, std::ios::binary);
+    if (!file) throw std::runtime_error("Couldn't open model \"" + path + "\"");
+    std::vector<unsigned char> data((std::istreambuf_iterator<char>(file)),
+                                    std::istreambuf_iterator<char>());
+
+    std::vector<ConvLayer> new_layers;
+    std::map<std::string, Tensor> constants;
+    int new_scale = 0;
+    float new_output_bias = 0;
+    bool new_output_tanh = false;
+    // PReLU is exported as relu(x) + alpha * (x - |x|) * 0.5
+    float negative_part_factor = 0;
+    std::vector<float> pending_slope;
+
+    auto unsupported = [&path](const std::string &what) {
+        return std::runtime_error("Model \"" + path + "\" isn't supported natively: " + what);
+    };
+    auto constantInput = [&constants](const GraphNode &node) -> const Tensor * {
+        for (const std::string &input : node.inputs) {
+            auto constant = constants.find(input);
+            if (constant != constants.end()) return &constant->second;
+        }
+        return nullptr;
+    };
+
+    ProtoReader graph(data.data(), data.size());
+    while (!graph.atEnd()) {
+        int wire_type;
+        if (graph.field(wire_type) != 1 || wire_type != 2) {
+            graph.skip(wire_type);
+            continue;
+        }
+        GraphNode node = parseNode(graph.message());
+        const Tensor *constant = constantInput(node);
+
+        if (node.op == "Const") {
+            if (node.has_value) constants[node.name] = std::move(node.value);
+        } else if (node.op == "Conv2D") {
+            if (new_scale != 0 || new_output_tanh) throw unsupported("convolution after output");
+            if (!constant || constant->shape.size() != 4) throw unsupported("non-constant filter");
+            if (node.padding != "SAME") throw unsupported("padding " + node.padding);
+            const std::vector<int> &shape = constant->shape;
+            int previous_channels = new_layers.empty() ? 1 : new_layers.back().real_out_channels;
+            if (shape[0] != shape[1] || shape[0] % 2 == 0 || shape[2] != previous_channels) {
+                throw unsupported("filter shape");
+            }
+
+            ConvLayer layer;
+            layer.kernel_size = shape[0];
+            layer.in_channels = new_layers.empty() ? 1 : new_layers.back().out_channels;
+            layer.real_out_channels = shape[3];
+            layer.out_channels = roundUp(shape[3], SIMD_WIDTH);
+            layer.weights.assign(static_cast<size_t>(layer.kernel_size) * layer.kernel_size *
+                                     layer.in_channels * layer.out_channels,
+                                 0.0f);
+            for (int k = 0; k < layer.kernel_size * layer.kernel_size; ++k) {
+                for (int ci = 0; ci < shape[2]; ++ci) {
+                    std::copy_n(constant->values.begin() + (k * shape[2] + ci) * shape[3],
+                                shape[3],
+                                layer.weights.begin() +
+                                    (k * layer.in_channels + ci) * layer.out_channels);
+                }
+            }
+            layer.bias.assign(layer.out_channels, 0.0f);
+            layer.negative_slope.assign(layer.out_channels, 1.0f);
+            new_layers.push_back(std::move(layer));
+        } else if (node.op == "Add" || node.op == "BiasAdd") {
+            if (new_layers.empty()) throw unsupported("addition before convolution");
+            ConvLayer &layer = new_layers.back();
+            if (!constant) {
+                // The sum of the positive and negative part of a PReLU
+                if (pending_slope.empty()) throw unsupported("addition of two tensors");
+                std::copy(pending_slope.begin(), pending_slope.end(), layer.negative_slope.begin());
+                pending_slope.clear();
+                negative_part_factor = 0;
+            } else if (new_scale != 0 && constant->values.size() == 1) {
+                new_output_bias += constant->values[0];
+            } else if (new_scale == 0 &&
+                       static_cast<int>(constant->values.size()) == layer.real_out_channels) {
+                for (int co = 0; co < layer.real_out_channels; ++co) {
+                    layer.bias[co] += constant->values[co];
+                }
+            } else {
+                throw unsupported("bias shape");
+            }
+        } else if (node.op == "Relu") {
+            if (new_layers.empty() || new_scale != 0) throw unsupported("activation placement");
+            std::fill(new_layers.back().negative_slope.begin(),
+                      new_layers.back().negative_slope.begin() +
+                          new_layers.back().real_out_channels,
+                      0.0f);
+        } else if (node.op == "Sub") {
+            negative_part_factor = 2;
+        } else if (node.op == "Mul") {
+            if (!constant || negative_part_factor == 0 || new_layers.empty()) {
+                throw unsupported("multiplication");
+            }
+            if (static_cast<int>(constant->values.size()) == new_layers.back().real_out_channels) {
+                pending_slope = constant->values;
+                for (float &slope : pending_slope) slope *= negative_part_factor;
+            } else if (constant->values.size() == 1 && !pending_slope.empty()) {
+                for (float &slope : pending_slope) slope *= constant->values[0];
+            } else {
+                throw unsupported("multiplication");
+            }
+        } else if (node.op == "DepthToSpace") {
+            if (new_layers.empty() || node.block_size < 2 ||
+                new_layers.back().real_out_channels != node.block_size * node.block_size) {
+                throw unsupported("depth to space");
+            }
+            new_scale = node.block_size;
+        } else if (node.op == "Tanh") {
+            new_output_tanh = true;
+        } else if (node.op != "Placeholder" && node.op != "Abs" && node.op != "Transpose" &&
+                   node.op != "Identity") {
+            throw unsupported("operation " + node.op);
+        }
+    }
+    if (new_layers.empty() || new_scale == 0) throw unsupported("no sub-pixel output");
+
+    layers = std::move(new_layers);
+    scale = new_scale;
+    output_bias = new_output_bias;
+    output_tanh = new_output_tanh;
+    receptive_radius = max_padding = 0;
+    max_channels = 1;
+    for (const ConvLayer &layer : layers) {
+        receptive_radius += layer.kernel_size / 2;
+        max_padding = std::max(max_padding, layer.kernel_size / 2);
+        max_channels = std::max(max_channels, layer.out_channels);
+    }
+}
+
+void NativeSRNetwork::runTile(const Planes &planes, int tile_x, int tile_y, int tile_width,
+                              int tile_height, InferenceBuffer &buffer0,
+                              InferenceBuffer &buffer1, InferenceBuffer &output) const {
+    static const ConvolveFunction convolve = selectConvolution();
+    int width = planes.width, height = planes.height;
+
+    // The tile is computed together with receptive_radius pixels of context on every side
+    int region_x = tile_x - receptive_radius, region_y = tile_y - receptive_radius;
+    int region_width = roundUp(tile_width + 2 * receptive_radius, PIXEL_BLOCK);
+    int region_height = tile_height + 2 * receptive_radius;
+    int pad = max_padding;
+    int stride = region_width + 2 * pad;
+    size_t buffer_size = static_cast<size_t>(region_height + 2 * pad) * stride * max_channels;
+    if (buffer0.size() < buffer_size) {
+        buffer0.resize(buffer_size);
+        buffer1.resize(buffer_size);
+    }
+
+    // Pixels outside the image are zero at every layer, as with per-layer SAME padding
+    int valid_x0 = std::max(-region_x, 0);
+    int valid_x1 = std::min(width - region_x, region_width);
+    int valid_y0 = std::max(-region_y, 0);
+    int valid_y1 = std::min(height - region_y, region_height);
+
+    float *input = buffer0.data(), *result = buffer1.data();
+    clearOutside(input, region_width, region_height, pad, 1, valid_x0, valid_x1, valid_y0,
+                 valid_y1);
+    for (int y = valid_y0; y < valid_y1; ++y) {
+        std::copy_n(planes.luma.begin() + static_cast<size_t>(region_y + y) * width + region_x +
+                        valid_x0,
+                    valid_x1 - valid_x0, input + (y + pad) * stride + valid_x0 + pad);
+    }
+
+    for (const ConvLayer &layer : layers) {
+        ConvParams params{layer.weights.data(),   layer.bias.data(),
+                          layer.negative_slope.data(), layer.kernel_size,
+                          layer.in_channels,      layer.out_channels};
+        convolve(params, input, result, region_width, region_height, pad);
+        clearOutside(result, region_width, region_height, pad, layer.out_channels, valid_x0,
+                     valid_x1, valid_y0, valid_y1);
+        std::swap(input, result);
+    }
+
+    int channels = layers.back().out_channels;
+    int output_width = width * scale;
+    for (int y = 0; y < tile_height; ++y) {
+        for (int x = 0; x < tile_width; ++x) {
+            const float *pixel = input + ((y + receptive_radius + pad) * stride + x +
+                                          receptive_radius + pad) *
+                                             channels;
+            for (int dy = 0; dy < scale; ++dy) {
+                float *out = output.data() +
+                             static_cast<size_t>((tile_y + y) * scale + dy) * output_width +
+                             (tile_x + x) * scale;
+                for (int dx = 0; dx < scale; ++dx) {
+                    float value = pixel[dy * scale + dx] + output_bias;
+                    out[dx] = output_tanh ? std::tanh(value) : value;
+                }
+            }
+        }
+    }
+}
+
+void NativeSRNetwork::upscaleLuma(std::vector<Planes> &batch) const {
+    int workers = threads > 0 ? threads : std::max<int>(std::thread::hardware_concurrency(), 1);
+
+    // Tiles of all images share one queue, so a batch of small images keeps every worker busy
+    int tile_size = TILE_SIZE;
+    auto tileCount = [&](int size) {
+        int count = 0;
+        for (const Planes &planes : batch) {
+            count += ((planes.width + size - 1) / size) * ((planes.height + size - 1) / size);
+        }
+        return count;
+    };
+    while (tile_size > MIN_TILE_SIZE && tileCount(tile_size) < 2 * workers) tile_size /= 2;
+
+    struct Tile {
+        Planes *planes;
+        int x, y;
+    };
+    std::vector<Tile> tiles;
+    for (Planes &planes : batch) {
+        planes.output_luma.assign(static_cast<size_t>(planes.width) * scale * planes.height * scale,
+                                  0.0f);
+        for (int y = 0; y < planes.height; y += tile_size) {
+            for (int x = 0; x < planes.width; x += tile_size) tiles.push_back({&planes, x, y});
+        }
+    }
+    workers = std::min<int>(workers, tiles.size());
+
+    std::atomic<size_t> next_tile(0);
+    auto work = [&]() {
+        InferenceBuffer buffer0, buffer1;
+        for (size_t index = next_tile++; index < tiles.size(); index = next_tile++) {
+            const Tile &tile = tiles[index];
+            runTile(*tile.planes, tile.x, tile.y, std::min(tile_size, tile.planes->width - tile.x),
+                    std::min(tile_size, tile.planes->height - tile.y), buffer0, buffer1,
+                    tile.planes->output_luma);
+        }
+    };
+    std::vector<std::thread> pool;
+    for (int worker = 1; worker < workers; ++worker) pool.emplace_back(work);
+    work();
+    for (std::thread &thread : pool) thread.join();
+}
+
+size_t NativeSRNetwork::estimateMemory(int width, int height) const noexcept {
+    size_t workers = threads > 0 ? threads : std::max<int>(std::thread::hardware_concurrency(), 1);
+    size_t pixels = static_cast<size_t>(width) * height;
+    // Luma, Cr and Cb planes plus the upscaled luma
+    size_t planes = (3 + static_cast<size_t>(scale) * scale) * pixels * sizeof(float);
+    int region = roundUp(TILE_SIZE + 2 * receptive_radius, PIXEL_BLOCK) + 2 * max_padding;
+    size_t tile_buffers = 2 * static_cast<size_t>(region) * region * max_channels * sizeof(float);
+    return planes + workers * tile_buffers;
+}
+
+void NativeSRNetwork::upscale(Image &image) const {
+    std::vector<Image> batch(1);
+    batch[0] = std::move(image);
+    upscale(batch);
+    image = std::move(batch[0]);
+}
+
+void NativeSRNetwork::upscale(std::vector<Image> &images) const {
+    if (!isLoaded()) throw std::runtime_error("Native model not loaded");
+
+    std::vector<Planes> batch;
+    std::vector<Image *> batch_images;
+    for (Image &image : images) {
+        if (image.width == 0 || image.height == 0) continue;
+        Planes planes;
+        planes.width = image.width;
+        planes.height = image.height;
+        planes.luma.resize(static_cast<size_t>(image.width) * image.height);
+        planes.cr.resize(planes.luma.size());
+        planes.cb.resize(planes.luma.size());
+        std::vector<rgbPixel> row_buffer(image.width);
+        for (int row = 0; row < image.height; ++row) {
+            const rgbPixel *pixels = image.readPixels(0, row, image.width, row_buffer.data());
+            size_t offset = static_cast<size_t>(row) * image.width;
+            for (int x = 0; x < image.width; ++x) {
+                int y, cr, cb;
+                bgrToYCrCb(pixels[x], y, cr, cb);
+                planes.luma[offset + x] = y / 255.0f;
+                planes.cr[offset + x] = cr / 255.0f;
+                planes.cb[offset + x] = cb / 255.0f;
+            }
+        }
+        batch.push_back(std::move(planes));
+        batch_images.push_back(&image);
+    }
+    if (batch.empty()) return;
+
+    upscaleLuma(batch);
+
+    for (size_t index = 0; index < batch.size(); ++index) {
+        const Planes &planes = batch[index];
+        Image &image = *batch_images[index];
+        int width = planes.width, height = planes.height;
+        int output_width = width * scale, output_height = height * scale;
+        std::vector<int> x_index, y_index;
+        std::vector<float> x_weight, y_weight;
+        bilinearCoefficients(width, scale, x_index, x_weight);
+        bilinearCoefficients(height, scale, y_index, y_weight);
+
+        Image result(output_width, output_height);
+        result.is_grayscale = image.is_grayscale;
+        for (int y = 0; y < output_height; ++y) {
+            size_t row0 = static_cast<size_t>(y_index[y]) * width;
+            size_t row1 = static_cast<size_t>(std::min(y_index[y] + 1, height - 1)) * width;
+            float wy = y_weight[y];
+            for (int x = 0; x < output_width; ++x) {
+                int x0 = x_index[x], x1 = std::min(x0 + 1, width - 1);
+                float wx = x_weight[x];
+                auto sample = [&](const InferenceBuffer &plane) {
+                    float top = plane[row0 + x0] * (1 - wx) + plane[row0 + x1] * wx;
+                    float bottom = plane[row1 + x0] * (1 - wx) + plane[row1 + x1] * wx;
+                    return top * (1 - wy) + bottom * wy;
+                };
+                int pixel_y = saturate(static_cast<int>(std::lrint(
+                    planes.output_luma[static_cast<size_t>(y) * output_width + x] * 255)));
+                int pixel_cr = saturate(static_cast<int>(std::lrint(sample(planes.cr) * 255)));
+                int pixel_cb = saturate(static_cast<int>(std::lrint(sample(planes.cb) * 255)));
+                result.pixels[static_cast<size_t>(y) * output_width + x] =
+                    yCrCbToBgr(pixel_y, pixel_cr, pixel_cb);
+            }
+        }
+        image = std::move(result);
+    }
+}
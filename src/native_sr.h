@@ -0,0 +1,61 @@
+#pragma once
+#include "image.h"
+#include <string>
+#include <vector>
+
+// CPU inference for the small sub-pixel convolution networks (ESPCN, FSRCNN) without the
+// OpenCV DNN stack. Weights are read from the same TensorFlow .pb files, the pre- and
+// post-processing follows cv::dnn_superres: the network upscales the Y channel of YCrCb,
+// Cr and Cb are upscaled bilinearly.
+class NativeSRNetwork {
+  public:
+    // False when IMAGETOOL_NATIVE_DNN=0 asks for OpenCV's DNN module instead
+    static bool enabled();
+    // Throws std::runtime_error if the file isn't a conv/activation/depth-to-space graph
+    void load(const std::string &path);
+    bool isLoaded() const noexcept { return !layers.empty(); }
+    int getScale() const noexcept { return scale; }
+    // 0 uses all hardware threads
+    void setThreads(int threads) noexcept { this->threads = threads; }
+
+    void upscale(Image &image) const;
+    // Tiles of all images are processed by one pool of workers, sizes may differ
+    void upscale(std::vector<Image> &images) const;
+    // Bytes of float planes and tile buffers needed to upscale a width x height image
+    size_t estimateMemory(int width, int height) const noexcept;
+
+  private:
+    struct ConvLayer {
+        int kernel_size;
+        int in_channels;
+        // Output channels rounded up to the SIMD width, the extra channels are always zero
+        int out_channels;
+        int real_out_channels;
+        // [kernel_y][kernel_x][in_channels][out_channels]
+        std::vector<float> weights;
+        std::vector<float> bias;
+        // Slope for negative inputs: 1 without activation, 0 for ReLU, alpha for PReLU
+        std::vector<float> negative_slope;
+    };
+
+    std::vector<ConvLayer> layers;
+    int scale = 0;
+    float output_bias = 0;
+    bool output_tanh = false;
+    // Rows/columns of context the whole network needs around an output pixel
+    int receptive_radius = 0;
+    int max_padding = 0;
+    int max_channels = 0;
+    int threads = 0;
+
+    struct Planes {
+        int width, height;
+        InferenceBuffer luma, cr, cb;
+        InferenceBuffer output_luma;
+    };
+
+    void upscaleLuma(std::vector<Planes> &batch) const;
+    void runTile(const Planes &planes, int tile_x, int tile_y, int tile_width, int tile_height,
+                 InferenceBuffer &buffer0, InferenceBuffer &buffer1,
+                 InferenceBuffer &output) const;
+};
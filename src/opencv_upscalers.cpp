@@ -0,0 +1,616 @@
+#include "opencv_upscalers.h"
+#include "upscaler_module.h"
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <exception>
+#include <map>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+
+// Rows of context added above and below every concurrently upscaled band, enough for the
+// receptive field of the models UpscalerFactory::supportsBands accepts
+static constexpr int BAND_HALO = 16;
+static constexpr int MIN_BAND_ROWS = 64;
+// The native engine is checked against cv::dnn_superres on a probe image spanning several of
+// its tiles before it is used, and may differ by this much per channel (rounding of the
+// fixed-point colour conversion)
+static constexpr int NATIVE_PROBE_SIZE = 96;
+static constexpr int NATIVE_TOLERANCE = 1;
+// BGR mean of the DIV2K training set, EDSR works on mean-free input
+static const cv::Scalar EDSR_MEAN(103.1545782, 111.5616438, 114.35629928);
+// Rough bytes of DNN activations per input and per output pixel, from the widest layers of
+// the standard models: ESPCN and FSRCNN work at input resolution, LapSRN's pyramid at output
+// resolution, EDSR at both
+struct ActivationFootprint {
+    size_t per_input_pixel;
+    size_t per_output_pixel;
+};
+static ActivationFootprint activationFootprint(UpscaleMethod method) {
+    switch (method) {
+    case UpscaleMethod::ESPCN:
+        return {512, 0};
+    case UpscaleMethod::FSRCNN:
+        return {448, 0};
+    case UpscaleMethod::EDSR:
+        return {3072, 1024};
+    case UpscaleMethod::LAPSRN:
+        return {0, 512};
+    default:
+        return {0, 0};
+    }
+}
+
+// Frames on each side of the one being upscaled that BTVL1 aligns and fuses with it
+static constexpr int BTVL1_TEMPORAL_RADIUS = 2;
+// OpenCV defaults to 180, most of the gain is in the first iterations
+static constexpr int BTVL1_ITERATIONS = 20;
+
+// Feeds the frames of a sequence to cv::superres as they are announced. BTVL1 keeps the
+// frames, optical flows and results of its temporal window in ring buffers, so each frame is
+// converted and each flow computed once and the cost per frame doesn't grow with the length.
+class SequenceFrameSource : public cv::superres::FrameSource {
+  public:
+    void nextFrame(cv::OutputArray frame) override {
+        if (frames.empty()) {
+            // BTVL1 finishes the frames of its window once no more arrive
+            frame.release();
+            return;
+        }
+        frames.front().copyTo(frame);
+        frames.pop_front();
+    }
+    void reset() override { frames.clear(); }
+
+    std::deque<cv::Mat> frames;
+};
+
+TraditionalUpscaler::TraditionalUpscaler(UpscaleMethod method)
+    : method(method), sequence_started(false), sequence_radius(0), frames_added(0),
+      frames_upscaled(0) {
+    if (method == UpscaleMethod::BTVL1) {
+        try {
+            sr_processor = cv::superres::createSuperResolution_BTVL1();
+            sequence_source = cv::makePtr<SequenceFrameSource>();
+        } catch (const cv::Exception &e) {
+            throw std::runtime_error("Failed to create BTVL1 processor: " + std::string(e.what()));
+        }
+    }
+}
+
+int TraditionalUpscaler::getLookahead() const {
+    // cv::superres reads a whole window before the first result and one frame per result
+    // after that, so it runs 2 * radius + 1 frames ahead of its output
+    return method == UpscaleMethod::BTVL1 ? 2 * BTVL1_TEMPORAL_RADIUS + 1 : 0;
+}
+
+void TraditionalUpscaler::addFrame(const Image &frame) {
+    if (method != UpscaleMethod::BTVL1) return;
+    sequence_source->frames.push_back(imageToMat(frame));
+    ++frames_added;
+}
+
+void TraditionalUpscaler::upscaleSequenceFrame(Image &image, int scale_factor) {
+    if (frames_upscaled == frames_added) {
+        throw std::runtime_error("BTVL1 frame " + std::to_string(frames_upscaled) +
+                                 " wasn't announced with addFrame");
+    }
+    if (!sequence_started) {
+        // cv::superres needs a full window up front, shorter sequences get a narrower one
+        int available = static_cast<int>(sequence_source->frames.size());
+        sequence_radius = std::min(BTVL1_TEMPORAL_RADIUS, (available - 1) / 2);
+        if (sequence_radius > 0) {
+            sr_processor->setScale(scale_factor);
+            sr_processor->setTemporalAreaRadius(sequence_radius);
+            sr_processor->setIterations(BTVL1_ITERATIONS);
+            sr_processor->setInput(sequence_source);
+        }
+        sequence_started = true;
+    }
+
+    cv::Mat output_mat;
+    try {
+        if (sequence_radius > 0) {
+            sr_processor->nextFrame(output_mat);
+        } else {
+            // One or two frames have no window to align, they are upscaled on their own
+            cv::Mat input_mat = sequence_source->frames.front();
+            sequence_source->frames.pop_front();
+            cv::Size new_size(input_mat.cols * scale_factor, input_mat.rows * scale_factor);
+            cv::resize(input_mat, output_mat, new_size, 0, 0, cv::INTER_LANCZOS4);
+        }
+    } catch (const cv::Exception &e) {
+        throw std::runtime_error("BTVL1 upscaling failed: " + std::string(e.what()));
+    }
+    ++frames_upscaled;
+    if (output_mat.empty()) {
+        throw std::runtime_error("Upscaling failed - output is empty");
+    }
+    matToImage(output_mat, image);
+}
+
+void TraditionalUpscaler::upscale(Image &image, int scale_factor) {
+    ScopedMemory working(MemoryCategory::INFERENCE,
+                         estimateMemory(image.getWidth(), image.getHeight(), scale_factor));
+    if (method == UpscaleMethod::BTVL1 && frames_added > 0) {
+        upscaleSequenceFrame(image, scale_factor);
+        return;
+    }
+
+    cv::Mat input_mat = imageToMat(image);
+    cv::Mat output_mat;
+
+    switch (method) {
+    case UpscaleMethod::BICUBIC: {
+        cv::Size new_size(image.getWidth() * scale_factor, image.getHeight() * scale_factor);
+        cv::resize(input_mat, output_mat, new_size, 0, 0, cv::INTER_CUBIC);
+        break;
+    }
+    case UpscaleMethod::LANCZOS: {
+        cv::Size new_size(image.getWidth() * scale_factor, image.getHeight() * scale_factor);
+        cv::resize(input_mat, output_mat, new_size, 0, 0, cv::INTER_LANCZOS4);
+        break;
+    }
+    case UpscaleMethod::BTVL1: {
+        // A single image has no neighbouring frames to fuse
+        cv::Size new_size(image.getWidth() * scale_factor, image.getHeight() * scale_factor);
+        cv::resize(input_mat, output_mat, new_size, 0, 0, cv::INTER_LANCZOS4);
+        break;
+    }
+    default:
+        throw std::invalid_argument("Unsupported traditional upscale method");
+    }
+
+    if (output_mat.empty()) {
+        throw std::runtime_error("Upscaling failed - output is empty");
+    }
+
+    matToImage(output_mat, image);
+}
+
+size_t TraditionalUpscaler::estimateMemory(int width, int height, int scale_factor) const {
+    // Input and output Mat
+    size_t pixels = static_cast<size_t>(width) * height;
+    size_t output_pixels = pixels * scale_factor * scale_factor;
+    size_t matrices = 3 * (pixels + output_pixels);
+    if (method != UpscaleMethod::BTVL1) return matrices;
+    // Per frame of the window the float frame, flows both ways, the float result and the high
+    // resolution motion maps, plus BTV-L1's working images and the queued frames
+    size_t window = 2 * BTVL1_TEMPORAL_RADIUS + 1;
+    return matrices + window * (28 * pixels + 28 * output_pixels) + 48 * output_pixels +
+           (window + 1) * 3 * pixels;
+}
+
+std::string TraditionalUpscaler::getName() const {
+    switch (method) {
+    case UpscaleMethod::BICUBIC:
+        return "Bicubic";
+    case UpscaleMethod::LANCZOS:
+        return "Lanczos";
+    case UpscaleMethod::BTVL1:
+        return "BTVL1";
+    default:
+        return "Unknown";
+    }
+}
+
+cv::Mat TraditionalUpscaler::imageToMat(const Image &image) {
+    cv::Mat mat(image.getHeight(), image.getWidth(), CV_8UC3);
+
+    for (int y = 0; y < image.getHeight(); ++y) {
+        for (int x = 0; x < image.getWidth(); ++x) {
+            rgbPixel pixel = const_cast<Image &>(image).getPixel(x, y);
+            cv::Vec3b &mat_pixel = mat.at<cv::Vec3b>(y, x);
+            mat_pixel[0] = pixel.b;
+            mat_pixel[1] = pixel.g;
+            mat_pixel[2] = pixel.r;
+        }
+    }
+
+    return mat;
+}
+
+void TraditionalUpscaler::matToImage(const cv::Mat &mat, Image &image) {
+    Image new_image(mat.cols, mat.rows);
+
+    for (int y = 0; y < mat.rows; ++y) {
+        for (int x = 0; x < mat.cols; ++x) {
+            const cv::Vec3b &mat_pixel = mat.at<cv::Vec3b>(y, x);
+            new_image.pixels[y * mat.cols + x] = rgbPixel(mat_pixel[2], mat_pixel[1], mat_pixel[0]);
+        }
+    }
+
+    image = std::move(new_image);
+}
+
+AIUpscaler::AIUpscaler(UpscaleMethod method, const std::string &model_path)
+    : method(method), model_loaded(false), model_path(model_path), has_config(false),
+      use_native(false) {
+    if (!model_path.empty()) {
+        model_loaded = loadModel(model_path);
+    }
+}
+
+static int dnnTarget(const DnnConfig &config) {
+#if CV_VERSION_MAJOR > 4 || (CV_VERSION_MAJOR == 4 && CV_VERSION_MINOR >= 8)
+    if (config.half_precision) return cv::dnn::DNN_TARGET_CPU_FP16;
+#endif
+    return cv::dnn::DNN_TARGET_CPU;
+}
+
+bool AIUpscaler::loadModel(const std::string &path) {
+    use_native = false;
+    if ((method == UpscaleMethod::ESPCN || method == UpscaleMethod::FSRCNN) &&
+        NativeSRNetwork::enabled()) {
+        try {
+            native.load(path);
+            use_native = nativeMatchesOpenCV(path);
+        } catch (const std::runtime_error &) {
+            // Unknown graph layouts are left to OpenCV
+        }
+    }
+
+    try {
+        if (!use_native) sr.readModel(path);
+        model_loaded = true;
+        model_path = path;
+        band_networks.clear();
+        batch_network = cv::dnn::Net();
+        // Without a tuning profile OpenCV's defaults are used
+        profile.load(DnnTuningProfile::defaultPath());
+        return true;
+    } catch (const cv::Exception &e) {
+        std::cerr << "Failed to load model: " << e.what() << std::endl;
+        model_loaded = false;
+        return false;
+    }
+}
+
+bool AIUpscaler::nativeMatchesOpenCV(const std::string &path) {
+    // Checked once per model file and process
+    static std::mutex mutex;
+    static std::map<std::string, bool> verdicts;
+    std::lock_guard<std::mutex> lock(mutex);
+    auto verdict = verdicts.find(path);
+    if (verdict != verdicts.end()) return verdict->second;
+
+    Image probe(NATIVE_PROBE_SIZE, NATIVE_PROBE_SIZE);
+    for (int y = 0; y < NATIVE_PROBE_SIZE; ++y) {
+        for (int x = 0; x < NATIVE_PROBE_SIZE; ++x) {
+            probe.setPixel(x, y,
+                           rgbPixel(x * 255 / NATIVE_PROBE_SIZE, y * 255 / NATIVE_PROBE_SIZE,
+                                    (x * 7 + y * 13) % 256));
+        }
+    }
+    Image native_output = probe;
+    native.upscale(native_output);
+
+    bool matches = true;
+    try {
+        cv::dnn_superres::DnnSuperResImpl reference;
+        reference.readModel(path);
+        reference.setModel(getModelName(), native.getScale());
+        cv::Mat reference_output;
+        reference.upsample(imageToMat(probe), reference_output);
+        double difference =
+            cv::norm(imageToMat(native_output), reference_output, cv::NORM_INF);
+        if (difference > NATIVE_TOLERANCE) {
+            std::cerr << "Warning: native " << getName() << " differs from OpenCV by up to "
+                      << difference << ", using OpenCV" << std::endl;
+            matches = false;
+        }
+    } catch (const cv::Exception &) {
+        // Without an OpenCV reference the native engine is the only one left
+    }
+    verdicts[path] = matches;
+    return matches;
+}
+
+void AIUpscaler::upscale(Image &image, int scale_factor) {
+    if (!model_loaded) {
+        throw std::runtime_error("AI model not loaded. Please load a model first.");
+    }
+
+    DnnConfig image_config = configFor(image.getWidth(), image.getHeight());
+    if (use_native) {
+        if (native.getScale() != scale_factor) {
+            throw std::runtime_error("AI upscaling failed: model " + model_path + " upscales by " +
+                                     std::to_string(native.getScale()));
+        }
+        native.setThreads(image_config.threads);
+        native.upscale(image);
+        return;
+    }
+
+    ScopedMemory working(MemoryCategory::INFERENCE,
+                         estimateMemory(image.getWidth(), image.getHeight(), scale_factor));
+    cv::Mat input_mat = imageToMat(image);
+    cv::Mat output_mat;
+
+    if (image_config.threads > 0) {
+        cv::setNumThreads(image_config.threads);
+    }
+
+    try {
+        upsampleBands(input_mat, output_mat, scale_factor, image_config.tile_workers,
+                      dnnTarget(image_config));
+    } catch (const cv::Exception &e) {
+        throw std::runtime_error("AI upscaling failed: " + std::string(e.what()));
+    }
+
+    if (output_mat.empty()) {
+        throw std::runtime_error("AI upscaling failed - output is empty");
+    }
+
+    matToImage(output_mat, image);
+}
+
+void AIUpscaler::upscale(std::vector<Image> &images, int scale_factor) {
+    if (!model_loaded) {
+        throw std::runtime_error("AI model not loaded. Please load a model first.");
+    }
+    if (images.empty()) return;
+
+    if (use_native) {
+        if (native.getScale() != scale_factor) {
+            throw std::runtime_error("AI upscaling failed: model " + model_path + " upscales by " +
+                                     std::to_string(native.getScale()));
+        }
+        native.setThreads(configFor(images[0].getWidth(), images[0].getHeight()).threads);
+        native.upscale(images);
+        return;
+    }
+
+    std::map<std::pair<int, int>, std::vector<Image *>> groups;
+    for (Image &image : images) {
+        groups[{image.getWidth(), image.getHeight()}].push_back(&image);
+    }
+    for (auto &[size, group] : groups) {
+        for (size_t first = 0; first < group.size(); first += MAX_BATCH_SIZE) {
+            size_t count = std::min(MAX_BATCH_SIZE, group.size() - first);
+            if (count == 1) {
+                upscale(*group[first], scale_factor);
+                continue;
+            }
+            try {
+                forwardBatch(std::vector<Image *>(group.begin() + first,
+                                                  group.begin() + first + count),
+                             scale_factor);
+            } catch (const cv::Exception &e) {
+                throw std::runtime_error("AI upscaling failed: " + std::string(e.what()));
+            }
+        }
+    }
+}
+
+// Same pre- and post-processing as DnnSuperResImpl::upsample, applied to a whole batch
+void AIUpscaler::forwardBatch(const std::vector<Image *> &batch, int scale_factor) {
+    if (batch_network.empty()) {
+        batch_network = cv::dnn::readNetFromTensorflow(model_path);
+    }
+    DnnConfig batch_config = configFor(batch[0]->getWidth(), batch[0]->getHeight());
+    if (batch_config.threads > 0) {
+        cv::setNumThreads(batch_config.threads);
+    }
+    batch_network.setPreferableBackend(cv::dnn::DNN_BACKEND_OPENCV);
+    batch_network.setPreferableTarget(dnnTarget(batch_config));
+    ScopedMemory working(MemoryCategory::INFERENCE,
+                         batch.size() * estimateMemory(batch[0]->getWidth(),
+                                                       batch[0]->getHeight(), scale_factor));
+
+    std::vector<cv::Mat> inputs, ycrcb(batch.size());
+    cv::Mat blob;
+    if (method == UpscaleMethod::EDSR) {
+        for (Image *image : batch) {
+            cv::Mat input;
+            imageToMat(*image).convertTo(input, CV_32F);
+            inputs.push_back(input);
+        }
+        blob = cv::dnn::blobFromImages(inputs, 1.0, cv::Size(), EDSR_MEAN);
+    } else {
+        // Only the Y channel goes through the network
+        for (size_t i = 0; i < batch.size(); ++i) {
+            cv::Mat converted;
+            cv::cvtColor(imageToMat(*batch[i]), converted, cv::COLOR_BGR2YCrCb);
+            converted.convertTo(ycrcb[i], CV_32F, 1.0 / 255.0);
+            cv::Mat channels[3];
+            cv::split(ycrcb[i], channels);
+            inputs.push_back(channels[0]);
+        }
+        blob = cv::dnn::blobFromImages(inputs, 1.0);
+    }
+
+    batch_network.setInput(blob);
+    std::vector<cv::Mat> outputs;
+    cv::dnn::imagesFromBlob(batch_network.forward(), outputs);
+    if (outputs.size() != batch.size()) {
+        throw std::runtime_error("AI upscaling failed - unexpected batch output");
+    }
+
+    for (size_t i = 0; i < batch.size(); ++i) {
+        cv::Mat result;
+        if (method == UpscaleMethod::EDSR) {
+            cv::Mat(outputs[i] + EDSR_MEAN).convertTo(result, CV_8U);
+        } else {
+            cv::Mat channels[3];
+            cv::split(ycrcb[i], channels);
+            cv::Mat cr, cb, merged, merged_8u;
+            cv::resize(channels[1], cr, cv::Size(), scale_factor, scale_factor);
+            cv::resize(channels[2], cb, cv::Size(), scale_factor, scale_factor);
+            cv::merge(std::vector<cv::Mat>{outputs[i], cr, cb}, merged);
+            merged.convertTo(merged_8u, CV_8U, 255.0);
+            cv::cvtColor(merged_8u, result, cv::COLOR_YCrCb2BGR);
+        }
+        matToImage(result, *batch[i]);
+    }
+}
+
+size_t AIUpscaler::estimateMemory(int width, int height, int scale_factor) const {
+    if (use_native) return native.estimateMemory(width, height);
+    size_t input_pixels = static_cast<size_t>(width) * height;
+    size_t output_pixels = input_pixels * scale_factor * scale_factor;
+    ActivationFootprint activations = activationFootprint(method);
+    // 8-bit input and output Mats, float YCrCb copies on both sides and the upscaled chroma
+    return 3 * input_pixels + 12 * input_pixels + 9 * output_pixels + 24 * output_pixels +
+           activations.per_input_pixel * input_pixels +
+           activations.per_output_pixel * output_pixels;
+}
+
+void AIUpscaler::setConfig(const DnnConfig &new_config) {
+    config = new_config;
+    has_config = true;
+}
+
+DnnConfig AIUpscaler::configFor(int width, int height) const {
+    if (has_config) return config;
+    DnnConfig tuned;
+    size_t slash = model_path.find_last_of('/');
+    std::string model_name = slash == std::string::npos ? model_path : model_path.substr(slash + 1);
+    profile.find(model_name, width, height, tuned);
+    return tuned;
+}
+
+void AIUpscaler::upsampleBands(const cv::Mat &input, cv::Mat &output, int scale_factor,
+                               int workers, int target) {
+    workers = std::max(std::min(workers, input.rows / MIN_BAND_ROWS), 1);
+    if (!UpscalerFactory::supportsBands(method)) workers = 1;
+    sr.setPreferableTarget(target);
+    sr.setModel(getModelName(), scale_factor);
+    if (workers == 1) {
+        sr.upsample(input, output);
+        return;
+    }
+
+    while (static_cast<int>(band_networks.size()) < workers - 1) {
+        auto network = std::make_unique<cv::dnn_superres::DnnSuperResImpl>();
+        network->readModel(model_path);
+        band_networks.push_back(std::move(network));
+    }
+
+    // Bands overlap by BAND_HALO rows so the receptive field at the seams sees real context,
+    // only the band's own rows are copied to the output
+    output.create(input.rows * scale_factor, input.cols * scale_factor, input.type());
+    std::vector<std::thread> threads;
+    std::vector<std::exception_ptr> errors(workers);
+    for (int worker = 0; worker < workers; ++worker) {
+        threads.emplace_back([&, worker]() {
+            try {
+                cv::dnn_superres::DnnSuperResImpl &network =
+                    worker == 0 ? sr : *band_networks[worker - 1];
+                if (worker > 0) {
+                    network.setPreferableTarget(target);
+                    network.setModel(getModelName(), scale_factor);
+                }
+                int y0 = input.rows * worker / workers;
+                int y1 = input.rows * (worker + 1) / workers;
+                int crop_y0 = std::max(y0 - BAND_HALO, 0);
+                int crop_y1 = std::min(y1 + BAND_HALO, input.rows);
+
+                cv::Mat band_output;
+                network.upsample(input.rowRange(crop_y0, crop_y1).clone(), band_output);
+                band_output
+                    .rowRange((y0 - crop_y0) * scale_factor, (y1 - crop_y0) * scale_factor)
+                    .copyTo(output.rowRange(y0 * scale_factor, y1 * scale_factor));
+            } catch (...) {
+                errors[worker] = std::current_exception();
+            }
+        });
+    }
+    for (std::thread &thread : threads) thread.join();
+    for (const std::exception_ptr &error : errors) {
+        if (error) std::rethrow_exception(error);
+    }
+}
+
+std::string AIUpscaler::getName() const {
+    switch (method) {
+    case UpscaleMethod::ESPCN:
+        return "ESPCN";
+    case UpscaleMethod::EDSR:
+        return "EDSR";
+    case UpscaleMethod::FSRCNN:
+        return "FSRCNN";
+    case UpscaleMethod::LAPSRN:
+        return "LAPSRN";
+    default:
+        return "Unknown AI";
+    }
+}
+
+std::string AIUpscaler::getModelName() const {
+    switch (method) {
+    case UpscaleMethod::ESPCN:
+        return "espcn";
+    case UpscaleMethod::EDSR:
+        return "edsr";
+    case UpscaleMethod::FSRCNN:
+        return "fsrcnn";
+    case UpscaleMethod::LAPSRN:
+        return "lapsrn";
+    default:
+        return "";
+    }
+}
+
+cv::Mat AIUpscaler::imageToMat(const Image &image) {
+    cv::Mat mat(image.getHeight(), image.getWidth(), CV_8UC3);
+
+    for (int y = 0; y < image.getHeight(); ++y) {
+        for (int x = 0; x < image.getWidth(); ++x) {
+            rgbPixel pixel = const_cast<Image &>(image).getPixel(x, y);
+            cv::Vec3b &mat_pixel = mat.at<cv::Vec3b>(y, x);
+            mat_pixel[0] = pixel.b;
+            mat_pixel[1] = pixel.g;
+            mat_pixel[2] = pixel.r;
+        }
+    }
+
+    return mat;
+}
+
+void AIUpscaler::matToImage(const cv::Mat &mat, Image &image) {
+    Image new_image(mat.cols, mat.rows);
+
+    for (int y = 0; y < mat.rows; ++y) {
+        for (int x = 0; x < mat.cols; ++x) {
+            const cv::Vec3b &mat_pixel = mat.at<cv::Vec3b>(y, x);
+            new_image.pixels[y * mat.cols + x] = rgbPixel(mat_pixel[2], mat_pixel[1], mat_pixel[0]);
+        }
+    }
+
+    image = std::move(new_image);
+}
+
+static BaseUpscaler *createUpscaler(UpscaleMethod method, const std::string &model_path) {
+    switch (method) {
+    case UpscaleMethod::BICUBIC:
+    case UpscaleMethod::LANCZOS:
+    case UpscaleMethod::BTVL1:
+        return new TraditionalUpscaler(method);
+
+    case UpscaleMethod::ESPCN:
+    case UpscaleMethod::EDSR:
+    case UpscaleMethod::FSRCNN:
+    case UpscaleMethod::LAPSRN:
+        return new AIUpscaler(method, model_path);
+
+    default:
+        throw std::invalid_argument("Unknown upscale method");
+    }
+}
+
+static bool halfPrecisionAvailable() {
+#if CV_VERSION_MAJOR > 4 || (CV_VERSION_MAJOR == 4 && CV_VERSION_MINOR >= 8)
+    return true;
+#else
+    return false;
+#endif
+}
+
+extern "C" const UpscalerModule *imageToolUpscalerModule() {
+    static const UpscalerModule module = {UPSCALER_MODULE_VERSION, createUpscaler,
+                                          halfPrecisionAvailable};
+    return &module;
+}
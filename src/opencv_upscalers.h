@@ -0,0 +1,83 @@
+#pragma once
+#include "native_sr.h"
+#include "upscaler.h"
+
+#include <opencv2/dnn_superres.hpp>
+#include <opencv2/opencv.hpp>
+#include <opencv2/superres.hpp>
+
+class SequenceFrameSource;
+
+class TraditionalUpscaler : public BaseUpscaler {
+  private:
+    UpscaleMethod method;
+    cv::Ptr<cv::superres::SuperResolution> sr_processor;
+    // BTVL1 on a sequence: frames passed to addFrame wait here until cv::superres reads them
+    cv::Ptr<SequenceFrameSource> sequence_source;
+    bool sequence_started;
+    // Temporal radius of the running sequence, 0 if it is too short to align frames
+    int sequence_radius;
+    int frames_added, frames_upscaled;
+
+  public:
+    explicit TraditionalUpscaler(UpscaleMethod method);
+    ~TraditionalUpscaler() override = default;
+
+    using BaseUpscaler::upscale;
+    void upscale(Image &image, int scale_factor) override;
+    std::string getName() const override;
+    bool isAI() const override { return false; }
+    size_t estimateMemory(int width, int height, int scale_factor) const override;
+    int getLookahead() const override;
+    void addFrame(const Image &frame) override;
+
+  private:
+    cv::Mat imageToMat(const Image &image);
+    void matToImage(const cv::Mat &mat, Image &image);
+    void upscaleSequenceFrame(Image &image, int scale_factor);
+};
+
+class AIUpscaler : public BaseUpscaler {
+  private:
+    UpscaleMethod method;
+    cv::dnn_superres::DnnSuperResImpl sr;
+    bool model_loaded;
+    std::string model_path;
+    DnnTuningProfile profile;
+    bool has_config;
+    DnnConfig config;
+    // Extra networks for concurrently upscaled bands, sr handles the first band
+    std::vector<std::unique_ptr<cv::dnn_superres::DnnSuperResImpl>> band_networks;
+    // ESPCN and FSRCNN bypass OpenCV's DNN module unless IMAGETOOL_NATIVE_DNN=0
+    NativeSRNetwork native;
+    bool use_native;
+    // Runs same sized images as one NCHW blob, DnnSuperResImpl only takes single images
+    cv::dnn::Net batch_network;
+
+  public:
+    static constexpr size_t MAX_BATCH_SIZE = 16;
+
+    explicit AIUpscaler(UpscaleMethod method, const std::string &model_path = "");
+    ~AIUpscaler() override = default;
+
+    void upscale(Image &image, int scale_factor) override;
+    // Same sized images are upscaled together in batches of up to MAX_BATCH_SIZE
+    void upscale(std::vector<Image> &images, int scale_factor) override;
+    std::string getName() const override;
+    bool isAI() const override { return true; }
+    size_t estimateMemory(int width, int height, int scale_factor) const override;
+    bool loadModel(const std::string &path);
+    // Overrides the configuration taken from the tuning profile
+    void setConfig(const DnnConfig &config) override;
+
+  private:
+    cv::Mat imageToMat(const Image &image);
+    void matToImage(const cv::Mat &mat, Image &image);
+    std::string getModelName() const;
+    DnnConfig configFor(int width, int height) const;
+    // Whether the loaded native network reproduces OpenCV's output within the tolerance
+    bool nativeMatchesOpenCV(const std::string &path);
+    void upsampleBands(const cv::Mat &input, cv::Mat &output, int scale_factor, int workers,
+                       int target);
+    void forwardBatch(const std::vector<Image *> &batch, int scale_factor);
+};
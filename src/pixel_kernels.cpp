@@ -0,0 +1,313 @@
+#include "pixel_kernels.h"
+#include "image.h"
+
+#include <algorithm>
+#include <cstring>
+#include <vector>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define PIXEL_KERNELS_X86 1
+#endif
+
+namespace {
+
+inline unsigned char clampByte(int value) noexcept {
+    return static_cast<unsigned char>(std::min(std::max(value, 0), 255));
+}
+
+// Same arithmetic as rgbPixel::toGrayScale
+inline unsigned char gray(int b, int g, int r) noexcept {
+    return clampByte(rgbPixel::RGB_TO_Y_R * r + rgbPixel::RGB_TO_Y_G * g +
+                     rgbPixel::RGB_TO_Y_B * b);
+}
+
+struct BilinearWeights {
+    float w1, w2, w3, w4;
+};
+
+// Same float expressions as Image::upSample, so the vector lanes round identically
+inline BilinearWeights bilinearWeights(int x_phase, int y_phase, int coefficient) noexcept {
+    float x_diff = (float)x_phase / coefficient;
+    float y_diff = (float)y_phase / coefficient;
+    return {(1 - x_diff) * (1 - y_diff), x_diff * (1 - y_diff), (1 - x_diff) * y_diff,
+            x_diff * y_diff};
+}
+
+inline unsigned char bilinear(const BilinearWeights &w, int p1, int p2, int p3,
+                              int p4) noexcept {
+    return static_cast<int>(w.w1 * p1 + w.w2 * p2 + w.w3 * p3 + w.w4 * p4);
+}
+
+// Samples [first, end) of output phase x_phase of one row: sample s of the source row goes to
+// pixel (s / channels) * coefficient + x_phase of the output
+void bilinearSamplesScalar(const SamplePlane &src, const unsigned char *row0,
+                           const unsigned char *row1, unsigned char *out, int coefficient,
+                           int x_phase, const BilinearWeights &w, int first) noexcept {
+    int channels = src.channels;
+    int last_pixel = src.width - 1;
+    for (int s = first; s < src.width * channels; ++s) {
+        int x = s / channels, c = s % channels;
+        int right = std::min(x + 1, last_pixel) * channels + c;
+        out[(x * coefficient + x_phase) * channels + c] =
+            bilinear(w, row0[s], row0[right], row1[s], row1[right]);
+    }
+}
+
+void boxDownsampleScalar(const SamplePlane &src, const SamplePlane &dst,
+                         int coefficient) noexcept {
+    int channels = src.channels;
+    int area = coefficient * coefficient;
+    // Column sums first, the inner loop then runs over contiguous samples and vectorizes
+    std::vector<uint32_t> sums(static_cast<size_t>(dst.width) * coefficient * channels);
+    for (int y = 0; y < dst.height; ++y) {
+        std::fill(sums.begin(), sums.end(), 0);
+        for (int dy = 0; dy < coefficient; ++dy) {
+            const unsigned char *in = src.row(y * coefficient + dy);
+            for (size_t i = 0; i < sums.size(); ++i) sums[i] += in[i];
+        }
+        unsigned char *out = dst.row(y);
+        for (int x = 0; x < dst.width; ++x) {
+            for (int c = 0; c < channels; ++c) {
+                uint32_t sum = 0;
+                for (int dx = 0; dx < coefficient; ++dx) {
+                    sum += sums[(x * coefficient + dx) * channels + c];
+                }
+                out[x * channels + c] = sum / area;
+            }
+        }
+    }
+}
+
+void bilinearUpsampleScalar(const SamplePlane &src, const SamplePlane &dst,
+                            int coefficient) noexcept {
+    for (int y = 0; y < dst.height; ++y) {
+        int y_base = y / coefficient;
+        const unsigned char *row0 = src.row(y_base);
+        const unsigned char *row1 = src.row(std::min(y_base + 1, src.height - 1));
+        for (int x_phase = 0; x_phase < coefficient; ++x_phase) {
+            BilinearWeights w = bilinearWeights(x_phase, y % coefficient, coefficient);
+            bilinearSamplesScalar(src, row0, row1, dst.row(y), coefficient, x_phase, w, 0);
+        }
+    }
+}
+
+uint64_t squaredErrorScalar(const unsigned char *a, const unsigned char *b, size_t n) noexcept {
+    uint64_t sum = 0;
+    for (size_t i = 0; i < n; ++i) {
+        int d = a[i] - b[i];
+        sum += d * d;
+    }
+    return sum;
+}
+
+void grayscaleScalar(const unsigned char *b, const unsigned char *g, const unsigned char *r,
+                     int step, int n, unsigned char *out) noexcept {
+    for (int x = 0; x < n; ++x) out[x] = gray(b[x * step], g[x * step], r[x * step]);
+}
+
+#ifdef PIXEL_KERNELS_X86
+// 8 bytes as floats
+__attribute__((target("avx2"))) inline __m256 loadFloats8(const unsigned char *p) noexcept {
+    __m128i bytes = _mm_loadl_epi64(reinterpret_cast<const __m128i *>(p));
+    return _mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(bytes));
+}
+
+// 4 bytes as 32-bit integers
+__attribute__((target("avx2"))) inline __m128i loadBytes4(const unsigned char *p) noexcept {
+    int32_t bytes;
+    memcpy(&bytes, p, sizeof(bytes));
+    return _mm_cvtepu8_epi32(_mm_cvtsi32_si128(bytes));
+}
+
+__attribute__((target("avx2"))) void boxDownsampleAVX2(const SamplePlane &src,
+                                                       const SamplePlane &dst,
+                                                       int coefficient) noexcept {
+    // Other factors are rare enough that the vectorized column sums of the scalar version do
+    if (coefficient != 2) {
+        boxDownsampleScalar(src, dst, coefficient);
+        return;
+    }
+    const __m256i ones = _mm256_set1_epi8(1);
+    const __m256i order = _mm256_setr_epi32(0, 4, 1, 5, 2, 6, 3, 7);
+    for (int y = 0; y < dst.height; ++y) {
+        const unsigned char *top = src.row(2 * y), *bottom = src.row(2 * y + 1);
+        unsigned char *out = dst.row(y);
+        int x = 0;
+        if (src.channels == 1) {
+            // 32 source samples give 16 outputs, maddubs adds the horizontal pairs
+            for (; x + 16 <= dst.width; x += 16) {
+                __m256i a = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(top + 2 * x));
+                __m256i b =
+                    _mm256_loadu_si256(reinterpret_cast<const __m256i *>(bottom + 2 * x));
+                __m256i sum = _mm256_add_epi16(_mm256_maddubs_epi16(a, ones),
+                                               _mm256_maddubs_epi16(b, ones));
+                __m256i packed = _mm256_packus_epi16(_mm256_srli_epi16(sum, 2), sum);
+                packed = _mm256_permute4x64_epi64(packed, 0x08);
+                _mm_storeu_si128(reinterpret_cast<__m128i *>(out + x),
+                                 _mm256_castsi256_si128(packed));
+            }
+        } else {
+            // 8 BGRX pixels give 4, each 128-bit lane holds two neighbouring 16-bit pixels
+            for (; x + 4 <= dst.width; x += 4) {
+                const unsigned char *a = top + 8 * x, *b = bottom + 8 * x;
+                __m256i low = _mm256_add_epi16(
+                    _mm256_cvtepu8_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i *>(a))),
+                    _mm256_cvtepu8_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i *>(b))));
+                __m256i high = _mm256_add_epi16(
+                    _mm256_cvtepu8_epi16(
+                        _mm_loadu_si128(reinterpret_cast<const __m128i *>(a + 16))),
+                    _mm256_cvtepu8_epi16(
+                        _mm_loadu_si128(reinterpret_cast<const __m128i *>(b + 16))));
+                low = _mm256_srli_epi16(_mm256_add_epi16(low, _mm256_srli_si256(low, 8)), 2);
+                high = _mm256_srli_epi16(_mm256_add_epi16(high, _mm256_srli_si256(high, 8)), 2);
+                __m256i sums = _mm256_unpacklo_epi64(low, high);
+                __m256i packed =
+                    _mm256_permutevar8x32_epi32(_mm256_packus_epi16(sums, sums), order);
+                _mm_storeu_si128(reinterpret_cast<__m128i *>(out + 4 * x),
+                                 _mm256_castsi256_si128(packed));
+            }
+        }
+        for (int i = x * src.channels; i < dst.width * src.channels; ++i) {
+            int c = i % src.channels, pixel = i / src.channels;
+            int left = 2 * pixel * src.channels + c, right = left + src.channels;
+            out[i] = (top[left] + top[right] + bottom[left] + bottom[right]) >> 2;
+        }
+    }
+}
+
+__attribute__((target("avx2"))) void bilinearUpsampleAVX2(const SamplePlane &src,
+                                                          const SamplePlane &dst,
+                                                          int coefficient) noexcept {
+    int channels = src.channels;
+    int shift = channels == 4 ? 2 : 0;
+    // Samples whose right neighbour is inside the row, the last pixel is clamped
+    int body = (src.width - 1) * channels;
+    alignas(32) unsigned char results[8];
+    for (int y = 0; y < dst.height; ++y) {
+        int y_base = y / coefficient;
+        const unsigned char *row0 = src.row(y_base);
+        const unsigned char *row1 = src.row(std::min(y_base + 1, src.height - 1));
+        unsigned char *out = dst.row(y);
+        for (int x_phase = 0; x_phase < coefficient; ++x_phase) {
+            BilinearWeights w = bilinearWeights(x_phase, y % coefficient, coefficient);
+            __m256 w1 = _mm256_set1_ps(w.w1), w2 = _mm256_set1_ps(w.w2);
+            __m256 w3 = _mm256_set1_ps(w.w3), w4 = _mm256_set1_ps(w.w4);
+            int s = 0;
+            for (; s + 8 <= body; s += 8) {
+                // Multiplications and additions in the order of the scalar expression
+                __m256 sum = _mm256_mul_ps(w1, loadFloats8(row0 + s));
+                sum = _mm256_add_ps(sum, _mm256_mul_ps(w2, loadFloats8(row0 + s + channels)));
+                sum = _mm256_add_ps(sum, _mm256_mul_ps(w3, loadFloats8(row1 + s)));
+                sum = _mm256_add_ps(sum, _mm256_mul_ps(w4, loadFloats8(row1 + s + channels)));
+                __m256i values = _mm256_cvttps_epi32(sum);
+                __m128i words = _mm_packus_epi32(_mm256_castsi256_si128(values),
+                                                 _mm256_extracti128_si256(values, 1));
+                _mm_storel_epi64(reinterpret_cast<__m128i *>(results),
+                                 _mm_packus_epi16(words, words));
+                for (int i = 0; i < 8; ++i) {
+                    int x = (s + i) >> shift, c = (s + i) & (channels - 1);
+                    out[(x * coefficient + x_phase) * channels + c] = results[i];
+                }
+            }
+            bilinearSamplesScalar(src, row0, row1, out, coefficient, x_phase, w, s);
+        }
+    }
+}
+
+__attribute__((target("avx2"))) uint64_t squaredErrorAVX2(const unsigned char *a,
+                                                          const unsigned char *b,
+                                                          size_t n) noexcept {
+    // A 32-bit lane gains at most 2 * 2 * 255^2 per block, so it is flushed every 4096 blocks
+    static constexpr size_t FLUSH_BLOCKS = 4096;
+    const __m256i zero = _mm256_setzero_si256();
+    uint64_t total = 0;
+    size_t i = 0;
+    while (i + 32 <= n) {
+        size_t end = std::min(n - n % 32, i + 32 * FLUSH_BLOCKS);
+        __m256i sums = zero;
+        for (; i < end; i += 32) {
+            __m256i va = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(a + i));
+            __m256i vb = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(b + i));
+            __m256i diff = _mm256_or_si256(_mm256_subs_epu8(va, vb), _mm256_subs_epu8(vb, va));
+            __m256i low = _mm256_unpacklo_epi8(diff, zero);
+            __m256i high = _mm256_unpackhi_epi8(diff, zero);
+            sums = _mm256_add_epi32(sums, _mm256_madd_epi16(low, low));
+            sums = _mm256_add_epi32(sums, _mm256_madd_epi16(high, high));
+        }
+        alignas(32) uint32_t lanes[8];
+        _mm256_store_si256(reinterpret_cast<__m256i *>(lanes), sums);
+        for (uint32_t lane : lanes) total += lane;
+    }
+    return total + squaredErrorScalar(a + i, b + i, n - i);
+}
+
+__attribute__((target("avx2"))) void grayscaleAVX2(const unsigned char *b, const unsigned char *g,
+                                                   const unsigned char *r, int step, int n,
+                                                   unsigned char *out) noexcept {
+    const __m256d kr = _mm256_set1_pd(rgbPixel::RGB_TO_Y_R);
+    const __m256d kg = _mm256_set1_pd(rgbPixel::RGB_TO_Y_G);
+    const __m256d kb = _mm256_set1_pd(rgbPixel::RGB_TO_Y_B);
+    const __m128i byte_mask = _mm_set1_epi32(0xff);
+    int x = 0;
+    for (; x + 4 <= n; x += 4) {
+        __m128i bs, gs, rs;
+        if (step == 1) {
+            bs = loadBytes4(b + x);
+            gs = loadBytes4(g + x);
+            rs = loadBytes4(r + x);
+        } else {
+            __m128i pixels = _mm_loadu_si128(reinterpret_cast<const __m128i *>(b + 4 * x));
+            bs = _mm_and_si128(pixels, byte_mask);
+            gs = _mm_and_si128(_mm_srli_epi32(pixels, 8), byte_mask);
+            rs = _mm_and_si128(_mm_srli_epi32(pixels, 16), byte_mask);
+        }
+        // (R * r + G * g) + B * b as in the scalar expression, truncated like the int cast
+        __m256d sum = _mm256_add_pd(_mm256_mul_pd(kr, _mm256_cvtepi32_pd(rs)),
+                                    _mm256_mul_pd(kg, _mm256_cvtepi32_pd(gs)));
+        sum = _mm256_add_pd(sum, _mm256_mul_pd(kb, _mm256_cvtepi32_pd(bs)));
+        __m128i values = _mm256_cvttpd_epi32(sum);
+        values = _mm_packus_epi16(_mm_packus_epi32(values, values), values);
+        int32_t bytes = _mm_cvtsi128_si32(values);
+        memcpy(out + x, &bytes, sizeof(bytes));
+    }
+    grayscaleScalar(b + x * step, g + x * step, r + x * step, step, n - x, out + x);
+}
+
+bool hasAVX2() {
+    static const bool supported = __builtin_cpu_supports("avx2");
+    return supported;
+}
+#endif
+
+} // namespace
+
+void boxDownsamplePlane(const SamplePlane &src, const SamplePlane &dst, int coefficient) noexcept {
+#ifdef PIXEL_KERNELS_X86
+    if (hasAVX2()) return boxDownsampleAVX2(src, dst, coefficient);
+#endif
+    boxDownsampleScalar(src, dst, coefficient);
+}
+
+void bilinearUpsamplePlane(const SamplePlane &src, const SamplePlane &dst,
+                           int coefficient) noexcept {
+#ifdef PIXEL_KERNELS_X86
+    if (hasAVX2()) return bilinearUpsampleAVX2(src, dst, coefficient);
+#endif
+    bilinearUpsampleScalar(src, dst, coefficient);
+}
+
+uint64_t squaredErrorBytes(const unsigned char *a, const unsigned char *b, size_t n) noexcept {
+#ifdef PIXEL_KERNELS_X86
+    if (hasAVX2()) return squaredErrorAVX2(a, b, n);
+#endif
+    return squaredErrorScalar(a, b, n);
+}
+
+void grayscaleSamples(const unsigned char *b, const unsigned char *g, const unsigned char *r,
+                      int step, int n, unsigned char *out) noexcept {
+#ifdef PIXEL_KERNELS_X86
+    if (hasAVX2()) return grayscaleAVX2(b, g, r, step, n, out);
+#endif
+    grayscaleScalar(b, g, r, step, n, out);
+}
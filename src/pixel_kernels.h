@@ -0,0 +1,26 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+
+// Kernels on the sample planes of the BGRX and PLANAR pixel layouts. A plane holds rows of
+// width pixels with `channels` interleaved samples each (4 for BGRX, 1 for a PLANAR channel),
+// rows start stride bytes apart. The results are exactly those of the packed BGR code in
+// image.cpp; AVX2 versions are picked at runtime where the CPU has it.
+struct SamplePlane {
+    unsigned char *data;
+    size_t stride;
+    int width, height, channels;
+    unsigned char *row(int y) const noexcept { return data + static_cast<size_t>(y) * stride; }
+};
+
+// Box filter of Image::downSample, dst is width / coefficient x height / coefficient
+void boxDownsamplePlane(const SamplePlane &src, const SamplePlane &dst, int coefficient) noexcept;
+// Bilinear interpolation of Image::upSample, dst is width * coefficient x height * coefficient
+void bilinearUpsamplePlane(const SamplePlane &src, const SamplePlane &dst,
+                           int coefficient) noexcept;
+// Sum of the squared differences of n bytes
+uint64_t squaredErrorBytes(const unsigned char *a, const unsigned char *b, size_t n) noexcept;
+// Gray value of rgbPixel::toGrayScale for n pixels. With step 1 b, g and r are separate
+// planes, with step 4 they point into the same BGRX pixels.
+void grayscaleSamples(const unsigned char *b, const unsigned char *g, const unsigned char *r,
+                      int step, int n, unsigned char *out) noexcept;
@@ -0,0 +1,125 @@
+#include "progressive.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <stdexcept>
+
+ProgressiveUpscaler::ProgressiveUpscaler(RefinerFactory make_refiner,
+                                         UpscaleMethod refiner_method, StageCallback on_stage,
+                                         int tile_size, int halo)
+    : preview(UpscalerFactory::createUpscaler(UpscaleMethod::BICUBIC)),
+      make_refiner(std::move(make_refiner)), refiner_method(refiner_method),
+      on_stage(std::move(on_stage)),
+      tile_size(std::max(tile_size, 1)), halo(std::max(halo, 0)) {}
+
+ProgressiveUpscaler::~ProgressiveUpscaler() {
+    if (worker.joinable()) worker.join();
+}
+
+void ProgressiveUpscaler::start(const Image &image, int scale_factor) {
+    if (worker.joinable()) {
+        throw std::runtime_error("Progressive upscaling is already running");
+    }
+    error = nullptr;
+    result = image;
+    preview->upscale(result, scale_factor);
+    if (on_stage) on_stage(result, 0, false);
+    worker = std::thread(&ProgressiveUpscaler::refine, this, image, scale_factor);
+}
+
+const Image &ProgressiveUpscaler::wait() {
+    if (worker.joinable()) worker.join();
+    if (error) std::rethrow_exception(error);
+    return result;
+}
+
+void ProgressiveUpscaler::upscale(Image &image, int scale_factor) {
+    start(image, scale_factor);
+    image = wait();
+}
+
+std::string ProgressiveUpscaler::getName() const {
+    return UpscalerFactory::methodToString(refiner_method) + " (progressive)";
+}
+
+size_t ProgressiveUpscaler::estimateMemory(int width, int height, int scale_factor) const {
+    // The source copy and the refined result live next to the preview's working memory, then
+    // one tile at a time goes through the refiner. The refiner may not exist yet, its working
+    // memory comes from an instance of the same method without a model.
+    std::unique_ptr<BaseUpscaler> estimator = UpscalerFactory::createUpscaler(refiner_method);
+    size_t source = 3 * static_cast<size_t>(width) * height;
+    size_t tile_width = std::min(tile_size + 2 * halo, width);
+    size_t tile_height = std::min(tile_size + 2 * halo, height);
+    size_t tile = 3 * tile_width * tile_height * (1 + scale_factor * scale_factor);
+    return source + source * scale_factor * scale_factor +
+           std::max(preview->estimateMemory(width, height, scale_factor),
+                    tile + estimator->estimateMemory(tile_width, tile_height, scale_factor));
+}
+
+void ProgressiveUpscaler::refine(Image source, int scale_factor) {
+    try {
+        if (!refiner) refiner = make_refiner();
+        int width = source.getWidth(), height = source.getHeight();
+        int columns = (width + tile_size - 1) / tile_size;
+        int rows = (height + tile_size - 1) / tile_size;
+        int center_x = (columns - 1) / 2, center_y = (rows - 1) / 2;
+        int rings = std::max({center_x, columns - 1 - center_x, center_y, rows - 1 - center_y});
+
+        for (int ring = 0; ring <= rings; ++ring) {
+            for (int ty = 0; ty < rows; ++ty) {
+                for (int tx = 0; tx < columns; ++tx) {
+                    if (std::max(std::abs(tx - center_x), std::abs(ty - center_y)) != ring) {
+                        continue;
+                    }
+                    int x = tx * tile_size, y = ty * tile_size;
+                    int w = std::min(tile_size, width - x), h = std::min(tile_size, height - y);
+                    int crop_x = std::max(x - halo, 0), crop_y = std::max(y - halo, 0);
+                    Image tile = source.crop(crop_x, crop_y,
+                                             std::min(x + w + halo, width) - crop_x,
+                                             std::min(y + h + halo, height) - crop_y);
+                    refiner->upscale(tile, scale_factor);
+                    result.paste(tile, (x - crop_x) * scale_factor, (y - crop_y) * scale_factor,
+                                 x * scale_factor, y * scale_factor, w * scale_factor,
+                                 h * scale_factor);
+                }
+            }
+            if (on_stage) on_stage(result, ring + 1, ring == rings);
+        }
+    } catch (...) {
+        error = std::current_exception();
+    }
+}
+
+TiledUpscaler::TiledUpscaler(std::unique_ptr<BaseUpscaler> tile_upscaler, int tile_size,
+                             int halo)
+    : tile_upscaler(std::move(tile_upscaler)), tile_size(std::max(tile_size, 1)),
+      halo(std::max(halo, 0)) {}
+
+void TiledUpscaler::upscale(Image &image, int scale_factor) {
+    int width = image.getWidth(), height = image.getHeight();
+    Image result(width * scale_factor, height * scale_factor);
+    for (int y = 0; y < height; y += tile_size) {
+        for (int x = 0; x < width; x += tile_size) {
+            int w = std::min(tile_size, width - x), h = std::min(tile_size, height - y);
+            int crop_x = std::max(x - halo, 0), crop_y = std::max(y - halo, 0);
+            Image tile = image.crop(crop_x, crop_y, std::min(x + w + halo, width) - crop_x,
+                                    std::min(y + h + halo, height) - crop_y);
+            tile_upscaler->upscale(tile, scale_factor);
+            result.paste(tile, (x - crop_x) * scale_factor, (y - crop_y) * scale_factor,
+                         x * scale_factor, y * scale_factor, w * scale_factor, h * scale_factor);
+        }
+    }
+    if (image.isGrayScale()) result.switchGrayScale();
+    image = std::move(result);
+}
+
+std::string TiledUpscaler::getName() const {
+    return tile_upscaler->getName() + " (" + std::to_string(tile_size) + "px tiles)";
+}
+
+size_t TiledUpscaler::estimateMemory(int width, int height, int scale_factor) const {
+    size_t tile_width = std::min(tile_size + 2 * halo, width);
+    size_t tile_height = std::min(tile_size + 2 * halo, height);
+    return 3 * tile_width * tile_height * (1 + scale_factor * scale_factor) +
+           tile_upscaler->estimateMemory(tile_width, tile_height, scale_factor);
+}
@@ -0,0 +1,71 @@
+#pragma once
+#include "upscaler.h"
+#include <algorithm>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <thread>
+
+// Emits a bicubic preview right away and then refines it with another upscaler tile by
+// tile, from the center of the image outwards. Every finished ring of tiles is reported
+// through the stage callback, which runs on the refinement thread. The refiner is created
+// on that thread too, so loading its model doesn't delay the preview.
+class ProgressiveUpscaler : public BaseUpscaler {
+  public:
+    // stage 0 is the preview, final is set for the fully refined image
+    using StageCallback = std::function<void(const Image &image, int stage, bool final)>;
+    using RefinerFactory = std::function<std::unique_ptr<BaseUpscaler>()>;
+
+    // make_refiner must create an upscaler of refiner_method
+    ProgressiveUpscaler(RefinerFactory make_refiner, UpscaleMethod refiner_method,
+                        StageCallback on_stage, int tile_size = 128, int halo = 16);
+    ~ProgressiveUpscaler() override;
+
+    // Returns once the preview has been emitted, refinement continues in the background
+    void start(const Image &image, int scale_factor);
+    // Blocks until refinement is done and rethrows its error, if any
+    const Image &wait();
+
+    using BaseUpscaler::upscale;
+    void upscale(Image &image, int scale_factor) override;
+    std::string getName() const override;
+    bool isAI() const override { return UpscalerFactory::isAIMethod(refiner_method); }
+    size_t estimateMemory(int width, int height, int scale_factor) const override;
+
+  private:
+    void refine(Image source, int scale_factor);
+
+    std::unique_ptr<BaseUpscaler> preview;
+    RefinerFactory make_refiner;
+    UpscaleMethod refiner_method;
+    std::unique_ptr<BaseUpscaler> refiner;
+    StageCallback on_stage;
+    int tile_size;
+    int halo;
+
+    Image result;
+    std::thread worker;
+    std::exception_ptr error;
+};
+
+// Upscales an image tile by tile with another upscaler, so the working memory is bounded by
+// the tile size instead of the image size. Tiles are cropped with halo pixels of context on
+// every side, which keeps the seams identical to upscaling the whole image as long as the
+// halo covers the upscaler's receptive field.
+class TiledUpscaler : public BaseUpscaler {
+  public:
+    TiledUpscaler(std::unique_ptr<BaseUpscaler> tile_upscaler, int tile_size, int halo = 16);
+
+    using BaseUpscaler::upscale;
+    void upscale(Image &image, int scale_factor) override;
+    std::string getName() const override;
+    bool isAI() const override { return tile_upscaler->isAI(); }
+    void setConfig(const DnnConfig &config) override { tile_upscaler->setConfig(config); }
+    size_t estimateMemory(int width, int height, int scale_factor) const override;
+    void setTileSize(int tile_size) noexcept { this->tile_size = std::max(tile_size, 1); }
+
+  private:
+    std::unique_ptr<BaseUpscaler> tile_upscaler;
+    int tile_size;
+    int halo;
+};
@@ -0,0 +1,195 @@
+#include "qoi.h"
+
+#include <cstring>
+#include <stdexcept>
+
+static constexpr unsigned char QOI_OP_INDEX = 0x00;
+static constexpr unsigned char QOI_OP_DIFF = 0x40;
+static constexpr unsigned char QOI_OP_LUMA = 0x80;
+static constexpr unsigned char QOI_OP_RUN = 0xc0;
+static constexpr unsigned char QOI_OP_RGB = 0xfe;
+static constexpr unsigned char QOI_OP_RGBA = 0xff;
+static constexpr unsigned char QOI_MASK_2 = 0xc0;
+static constexpr unsigned char QOI_PADDING[8] = {0, 0, 0, 0, 0, 0, 0, 1};
+static constexpr int QOI_HEADER_SIZE = 14;
+static constexpr size_t QOI_BUFFER_SIZE = 1 << 16;
+static constexpr uint64_t QOI_MAX_PIXELS = 400000000;
+
+// Pixels are kept as 0xAARRGGBB words so that comparisons are single instructions
+static inline uint32_t pack(unsigned char r, unsigned char g, unsigned char b,
+                            unsigned char a = 255) noexcept {
+    return (uint32_t(a) << 24) | (uint32_t(r) << 16) | (uint32_t(g) << 8) | b;
+}
+
+static inline int hash(uint32_t px) noexcept {
+    return (((px >> 16) & 0xff) * 3 + ((px >> 8) & 0xff) * 5 + (px & 0xff) * 7 + (px >> 24) * 11) %
+           64;
+}
+
+static inline void writeBigEndian(unsigned char *out, uint32_t value) noexcept {
+    out[0] = value >> 24;
+    out[1] = value >> 16;
+    out[2] = value >> 8;
+    out[3] = value;
+}
+
+static inline uint32_t readBigEndian(const unsigned char *in) noexcept {
+    return (uint32_t(in[0]) << 24) | (uint32_t(in[1]) << 16) | (uint32_t(in[2]) << 8) | in[3];
+}
+
+QOIEncoder::QOIEncoder(FILE *file, int width, int height)
+    : file(file), width(width), previous(pack(0, 0, 0)), run(0) {
+    if (!file) {
+        throw std::runtime_error("Invalid file handle");
+    }
+    buffer.reserve(QOI_BUFFER_SIZE);
+    memset(index, 0, sizeof(index));
+
+    unsigned char header[QOI_HEADER_SIZE] = {'q', 'o', 'i', 'f'};
+    writeBigEndian(header + 4, width);
+    writeBigEndian(header + 8, height);
+    header[12] = 3; // channels
+    header[13] = 0; // sRGB with linear alpha
+    if (fwrite(header, 1, QOI_HEADER_SIZE, file) != QOI_HEADER_SIZE) {
+        throw std::runtime_error("Couldn't write to file");
+    }
+}
+
+void QOIEncoder::put(unsigned char byte) { buffer.push_back(byte); }
+
+void QOIEncoder::flush() {
+    if (fwrite(buffer.data(), 1, buffer.size(), file) != buffer.size()) {
+        throw std::runtime_error("Couldn't write to file");
+    }
+    buffer.clear();
+}
+
+void QOIEncoder::writeRow(const rgbPixel *row) {
+    for (int x = 0; x < width; ++x) {
+        uint32_t px = pack(row[x].r, row[x].g, row[x].b);
+        if (px == previous) {
+            if (++run == 62) {
+                put(QOI_OP_RUN | (run - 1));
+                run = 0;
+            }
+            continue;
+        }
+        if (run > 0) {
+            put(QOI_OP_RUN | (run - 1));
+            run = 0;
+        }
+
+        int index_position = hash(px);
+        if (index[index_position] == px) {
+            put(QOI_OP_INDEX | index_position);
+        } else {
+            index[index_position] = px;
+
+            signed char dr = row[x].r - ((previous >> 16) & 0xff);
+            signed char dg = row[x].g - ((previous >> 8) & 0xff);
+            signed char db = row[x].b - (previous & 0xff);
+            signed char dr_dg = dr - dg;
+            signed char db_dg = db - dg;
+
+            if (dr > -3 && dr < 2 && dg > -3 && dg < 2 && db > -3 && db < 2) {
+                put(QOI_OP_DIFF | (dr + 2) << 4 | (dg + 2) << 2 | (db + 2));
+            } else if (dr_dg > -9 && dr_dg < 8 && dg > -33 && dg < 32 && db_dg > -9 &&
+                       db_dg < 8) {
+                put(QOI_OP_LUMA | (dg + 32));
+                put((dr_dg + 8) << 4 | (db_dg + 8));
+            } else {
+                put(QOI_OP_RGB);
+                put(row[x].r);
+                put(row[x].g);
+                put(row[x].b);
+            }
+        }
+        previous = px;
+    }
+    if (buffer.size() >= QOI_BUFFER_SIZE) flush();
+}
+
+void QOIEncoder::finish() {
+    if (run > 0) {
+        put(QOI_OP_RUN | (run - 1));
+        run = 0;
+    }
+    for (unsigned char byte : QOI_PADDING) put(byte);
+    flush();
+}
+
+QOIDecoder::QOIDecoder(FILE *file)
+    : file(file), buffer(QOI_BUFFER_SIZE), position(0), available(0), previous(pack(0, 0, 0)),
+      run(0) {
+    if (!file) {
+        throw std::runtime_error("Invalid file handle");
+    }
+    memset(index, 0, sizeof(index));
+
+    unsigned char header[QOI_HEADER_SIZE];
+    if (fread(header, 1, QOI_HEADER_SIZE, file) != QOI_HEADER_SIZE) {
+        throw std::runtime_error("Failed to read QOI header");
+    }
+    if (memcmp(header, "qoif", 4) != 0) {
+        throw std::runtime_error("Invalid QOI signature");
+    }
+    uint32_t header_width = readBigEndian(header + 4);
+    uint32_t header_height = readBigEndian(header + 8);
+    if (header_width == 0 || header_height == 0 ||
+        uint64_t(header_width) * header_height > QOI_MAX_PIXELS ||
+        (header[12] != 3 && header[12] != 4)) {
+        throw std::runtime_error("Invalid QOI header");
+    }
+    width = header_width;
+    height = header_height;
+}
+
+int QOIDecoder::getWidth() const noexcept { return width; }
+
+int QOIDecoder::getHeight() const noexcept { return height; }
+
+unsigned char QOIDecoder::next() {
+    if (position == available) {
+        available = fread(buffer.data(), 1, buffer.size(), file);
+        position = 0;
+        if (available == 0) {
+            throw std::runtime_error("Unexpected end of QOI data");
+        }
+    }
+    return buffer[position++];
+}
+
+void QOIDecoder::readRow(rgbPixel *row) {
+    for (int x = 0; x < width; ++x) {
+        if (run > 0) {
+            --run;
+        } else {
+            unsigned char b1 = next();
+            if (b1 == QOI_OP_RGB) {
+                unsigned char r = next(), g = next(), b = next();
+                previous = pack(r, g, b, previous >> 24);
+            } else if (b1 == QOI_OP_RGBA) {
+                unsigned char r = next(), g = next(), b = next(), a = next();
+                previous = pack(r, g, b, a);
+            } else if ((b1 & QOI_MASK_2) == QOI_OP_INDEX) {
+                previous = index[b1];
+            } else if ((b1 & QOI_MASK_2) == QOI_OP_DIFF) {
+                unsigned char r = ((previous >> 16) & 0xff) + ((b1 >> 4) & 0x03) - 2;
+                unsigned char g = ((previous >> 8) & 0xff) + ((b1 >> 2) & 0x03) - 2;
+                unsigned char b = (previous & 0xff) + (b1 & 0x03) - 2;
+                previous = pack(r, g, b, previous >> 24);
+            } else if ((b1 & QOI_MASK_2) == QOI_OP_LUMA) {
+                unsigned char b2 = next();
+                int dg = (b1 & 0x3f) - 32;
+                unsigned char r = ((previous >> 16) & 0xff) + dg - 8 + ((b2 >> 4) & 0x0f);
+                unsigned char g = ((previous >> 8) & 0xff) + dg;
+                unsigned char b = (previous & 0xff) + dg - 8 + (b2 & 0x0f);
+                previous = pack(r, g, b, previous >> 24);
+            } else {
+                run = b1 & 0x3f;
+            }
+            index[hash(previous)] = previous;
+        }
+        row[x] = rgbPixel((previous >> 16) & 0xff, (previous >> 8) & 0xff, previous & 0xff);
+    }
+}
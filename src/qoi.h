@@ -0,0 +1,51 @@
+#pragma once
+#include "image.h"
+#include <cstdint>
+#include <cstdio>
+#include <vector>
+
+// "Quite OK Image" lossless codec (https://qoiformat.org), 3-channel sRGB only on output.
+// Both sides stream row by row through an internal buffer, so memory use doesn't depend on
+// the image size.
+
+class QOIEncoder {
+  public:
+    QOIEncoder(FILE *file, int width, int height);
+
+    void writeRow(const rgbPixel *row);
+    // Flushes the pending run and writes the end marker
+    void finish();
+
+  private:
+    void put(unsigned char byte);
+    void flush();
+
+    FILE *file;
+    int width;
+    CodecBuffer buffer;
+    uint32_t index[64];
+    uint32_t previous;
+    int run;
+};
+
+class QOIDecoder {
+  public:
+    explicit QOIDecoder(FILE *file);
+
+    int getWidth() const noexcept;
+    int getHeight() const noexcept;
+    void readRow(rgbPixel *row);
+
+  private:
+    unsigned char next();
+
+    FILE *file;
+    int width;
+    int height;
+    CodecBuffer buffer;
+    size_t position;
+    size_t available;
+    uint32_t index[64];
+    uint32_t previous;
+    int run;
+};
@@ -0,0 +1,364 @@
+#include "shard.h"
+#include "image.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <csignal>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <fcntl.h>
+#include <fstream>
+#include <poll.h>
+#include <sstream>
+#include <stdexcept>
+#include <sys/prctl.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <dirent.h>
+
+static constexpr const char *SELF_EXECUTABLE = "/proc/self/exe";
+static constexpr int POLL_INTERVAL_MS = 200;
+static constexpr size_t COPY_CHUNK_SIZE = 1 << 20;
+
+static void sendLine(int fd, const std::string &line) {
+    std::string message = line + "\n";
+    size_t sent = 0;
+    while (sent < message.size()) {
+        ssize_t written = send(fd, message.data() + sent, message.size() - sent, MSG_NOSIGNAL);
+        if (written < 0 && errno == EINTR) continue;
+        if (written <= 0) throw std::runtime_error("Lost connection to shard peer");
+        sent += written;
+    }
+}
+
+// Appends whatever is available on fd to buffer, false once the peer has closed
+static bool receive(int fd, std::string &buffer) {
+    char chunk[4096];
+    ssize_t received;
+    do {
+        received = recv(fd, chunk, sizeof(chunk), 0);
+    } while (received < 0 && errno == EINTR);
+    if (received <= 0) return false;
+    buffer.append(chunk, received);
+    return true;
+}
+
+static bool takeLine(std::string &buffer, std::string &line) {
+    size_t end = buffer.find('\n');
+    if (end == std::string::npos) return false;
+    line = buffer.substr(0, end);
+    buffer.erase(0, end + 1);
+    return true;
+}
+
+static sockaddr_un socketAddress(const std::string &path) {
+    sockaddr_un address{};
+    address.sun_family = AF_UNIX;
+    if (path.size() >= sizeof(address.sun_path)) {
+        throw std::invalid_argument("Socket path is too long: " + path);
+    }
+    strcpy(address.sun_path, path.c_str());
+    return address;
+}
+
+ShardCoordinator::ShardCoordinator() {
+    const char *temp = getenv("TMPDIR");
+    std::string pattern = std::string(temp && *temp ? temp : "/tmp") + "/imagetool-XXXXXX";
+    std::vector<char> path(pattern.begin(), pattern.end());
+    path.push_back('\0');
+    if (!mkdtemp(path.data())) {
+        throw std::runtime_error("Couldn't create shard directory in \"" + pattern + "\"");
+    }
+    directory = path.data();
+    socket_path = directory + "/coordinator.sock";
+}
+
+ShardCoordinator::~ShardCoordinator() {
+    if (listen_fd >= 0) close(listen_fd);
+    for (pid_t pid : worker_pids) {
+        kill(pid, SIGTERM);
+        waitpid(pid, nullptr, 0);
+    }
+    if (DIR *dir = opendir(directory.c_str())) {
+        while (dirent *entry = readdir(dir)) {
+            std::string name = entry->d_name;
+            if (name != "." && name != "..") unlink((directory + "/" + name).c_str());
+        }
+        closedir(dir);
+    }
+    rmdir(directory.c_str());
+}
+
+void ShardCoordinator::addShard(Shard shard) {
+    for (const std::string &argument : shard.arguments) {
+        if (argument.find('\n') != std::string::npos) {
+            throw std::invalid_argument("Shard arguments must not contain line breaks");
+        }
+    }
+    shards.push_back(std::move(shard));
+}
+
+void ShardCoordinator::run(int workers, std::ostream &report) {
+    if (shards.empty()) return;
+    listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    sockaddr_un address = socketAddress(socket_path);
+    if (listen_fd < 0 || bind(listen_fd, (sockaddr *)&address, sizeof(address)) != 0 ||
+        listen(listen_fd, workers) != 0) {
+        throw std::runtime_error("Couldn't listen on \"" + socket_path +
+                                 "\": " + strerror(errno));
+    }
+
+    for (int i = 0; i < workers; ++i) {
+        pid_t pid = fork();
+        if (pid < 0) throw std::runtime_error("Couldn't start worker process");
+        if (pid == 0) {
+            prctl(PR_SET_PDEATHSIG, SIGTERM);
+            execl(SELF_EXECUTABLE, "imageTool", "--worker", socket_path.c_str(), (char *)nullptr);
+            _exit(127);
+        }
+        worker_pids.push_back(pid);
+    }
+
+    struct Connection {
+        int fd;
+        std::string buffer;
+        // Index into stats once the worker has introduced itself
+        int worker = -1;
+        int shard = -1;
+    };
+    std::vector<Connection> connections;
+    std::deque<int> pending;
+    for (size_t i = 0; i < shards.size(); ++i) pending.push_back(static_cast<int>(i));
+    size_t remaining = shards.size();
+
+    // A shard that failed or whose worker went away goes back to the front of the queue
+    auto fail = [&](Connection &connection, const std::string &reason) {
+        Shard &shard = shards[connection.shard];
+        if (connection.worker >= 0) ++stats[connection.worker].failures;
+        report << "Shard " << connection.shard << " (" << shard.description << ") failed on "
+               << "attempt " << shard.attempts << ": " << reason << std::endl;
+        if (shard.attempts >= MAX_ATTEMPTS) {
+            throw std::runtime_error("Shard " + std::to_string(connection.shard) + " failed " +
+                                     std::to_string(shard.attempts) + " times");
+        }
+        pending.push_front(connection.shard);
+        connection.shard = -1;
+    };
+
+    while (remaining > 0) {
+        std::vector<pollfd> fds = {{listen_fd, POLLIN, 0}};
+        for (const Connection &connection : connections) fds.push_back({connection.fd, POLLIN, 0});
+        if (poll(fds.data(), fds.size(), POLL_INTERVAL_MS) < 0 && errno != EINTR) {
+            throw std::runtime_error("poll failed: " + std::string(strerror(errno)));
+        }
+
+        if (fds[0].revents & POLLIN) {
+            int fd = accept4(listen_fd, nullptr, nullptr, SOCK_CLOEXEC);
+            if (fd >= 0) connections.push_back({fd, "", -1, -1});
+        }
+
+        std::vector<bool> closed(connections.size(), false);
+        for (size_t i = 0; i + 1 < fds.size() && i < connections.size(); ++i) {
+            if (!fds[i + 1].revents) continue;
+            Connection &connection = connections[i];
+            bool open = receive(connection.fd, connection.buffer);
+            std::string line;
+            while (takeLine(connection.buffer, line)) {
+                std::istringstream message(line);
+                std::string command;
+                message >> command;
+                if (command == "READY") {
+                    ShardWorkerStats worker;
+                    message >> worker.pid;
+                    connection.worker = static_cast<int>(stats.size());
+                    stats.push_back(worker);
+                } else if (command == "DONE" && connection.shard >= 0) {
+                    int id = -1, status = -1;
+                    double seconds = 0;
+                    message >> id >> status >> seconds;
+                    ShardWorkerStats &worker = stats[connection.worker];
+                    worker.busy_seconds += seconds;
+                    if (status != 0) {
+                        fail(connection, "exit status " + std::to_string(status));
+                        continue;
+                    }
+                    Shard &shard = shards[connection.shard];
+                    shard.done = true;
+                    ++worker.shards;
+                    worker.items += shard.items;
+                    connection.shard = -1;
+                    --remaining;
+                }
+            }
+            if (!open) {
+                if (connection.shard >= 0) fail(connection, "worker disconnected");
+                close(connection.fd);
+                closed[i] = true;
+            }
+        }
+        for (size_t i = connections.size(); i-- > 0;) {
+            if (closed[i]) connections.erase(connections.begin() + i);
+        }
+
+        for (Connection &connection : connections) {
+            if (pending.empty()) break;
+            if (connection.worker < 0 || connection.shard >= 0) continue;
+            connection.shard = pending.front();
+            pending.pop_front();
+            Shard &shard = shards[connection.shard];
+            ++shard.attempts;
+            sendLine(connection.fd, "SHARD " + std::to_string(connection.shard));
+            for (const std::string &argument : shard.arguments) {
+                sendLine(connection.fd, "ARG " + argument);
+            }
+            sendLine(connection.fd, "RUN");
+        }
+
+        // Reap local workers that died, e.g. because the executable couldn't be started
+        pid_t pid;
+        while ((pid = waitpid(-1, nullptr, WNOHANG)) > 0) {
+            worker_pids.erase(std::remove(worker_pids.begin(), worker_pids.end(), pid),
+                              worker_pids.end());
+        }
+        if (remaining > 0 && worker_pids.empty() && connections.empty()) {
+            throw std::runtime_error("All workers exited before the job was finished");
+        }
+    }
+
+    for (Connection &connection : connections) {
+        try {
+            sendLine(connection.fd, "EXIT");
+        } catch (const std::runtime_error &) {
+        }
+        close(connection.fd);
+    }
+    for (pid_t pid : worker_pids) waitpid(pid, nullptr, 0);
+    worker_pids.clear();
+}
+
+void ShardCoordinator::mergeOutputs(const std::string &output_filename) const {
+    FILE *output = openImageFile(output_filename, "wb");
+    std::vector<char> chunk(COPY_CHUNK_SIZE);
+    try {
+        for (const Shard &shard : shards) {
+            if (shard.output_filename.empty()) continue;
+            FILE *input = openImageFile(shard.output_filename, "rb");
+            size_t read;
+            while ((read = fread(chunk.data(), 1, chunk.size(), input)) > 0) {
+                if (fwrite(chunk.data(), 1, read, output) != read) {
+                    closeImageFile(input);
+                    throw std::runtime_error("Couldn't write to file");
+                }
+            }
+            closeImageFile(input);
+        }
+    } catch (const std::exception &) {
+        closeImageFile(output);
+        throw;
+    }
+    closeImageFile(output);
+}
+
+// Runs one shard as a separate imageTool process, returns its exit status
+static int runShard(const std::vector<std::string> &arguments) {
+    std::vector<char *> argv = {const_cast<char *>("imageTool")};
+    for (const std::string &argument : arguments) argv.push_back(const_cast<char *>(argument.c_str()));
+    argv.push_back(nullptr);
+
+    pid_t pid = fork();
+    if (pid < 0) return 127;
+    if (pid == 0) {
+        // A shard must not outlive its worker, the retry elsewhere writes the same output.
+        // Progress reports of the shards would interleave, errors still reach stderr.
+        prctl(PR_SET_PDEATHSIG, SIGKILL);
+        int null = open("/dev/null", O_WRONLY);
+        if (null >= 0) dup2(null, STDOUT_FILENO);
+        execv(SELF_EXECUTABLE, argv.data());
+        _exit(127);
+    }
+    int status = 0;
+    while (waitpid(pid, &status, 0) < 0 && errno == EINTR) {
+    }
+    if (WIFEXITED(status)) return WEXITSTATUS(status);
+    return 128 + (WIFSIGNALED(status) ? WTERMSIG(status) : 0);
+}
+
+int runShardWorker(const std::string &socket_path) {
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    sockaddr_un address = socketAddress(socket_path);
+    if (fd < 0 || connect(fd, (sockaddr *)&address, sizeof(address)) != 0) {
+        throw std::runtime_error("Couldn't connect to \"" + socket_path +
+                                 "\": " + strerror(errno));
+    }
+    sendLine(fd, "READY " + std::to_string(getpid()));
+
+    std::string buffer, line;
+    std::vector<std::string> arguments;
+    int shard = -1;
+    while (true) {
+        if (!takeLine(buffer, line)) {
+            if (!receive(fd, buffer)) break;
+            continue;
+        }
+        if (line.compare(0, 6, "SHARD ") == 0) {
+            shard = atoi(line.c_str() + 6);
+            arguments.clear();
+        } else if (line.compare(0, 4, "ARG ") == 0) {
+            arguments.push_back(line.substr(4));
+        } else if (line == "RUN") {
+            auto start = std::chrono::steady_clock::now();
+            int status = runShard(arguments);
+            double seconds =
+                std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+            sendLine(fd, "DONE " + std::to_string(shard) + " " + std::to_string(status) + " " +
+                             std::to_string(seconds));
+        } else if (line == "EXIT") {
+            break;
+        }
+    }
+    close(fd);
+    return 0;
+}
+
+std::vector<std::string> shardBaseArguments(int argc, char *argv[]) {
+    static const char *const OPTIONS_WITH_VALUE[] = {"--workers", "--manifest", "--shard-frames",
+                                                     "--input",   "--output",   "--frames"};
+    std::vector<std::string> arguments;
+    for (int i = 1; i < argc; ++i) {
+        bool skip = false;
+        for (const char *option : OPTIONS_WITH_VALUE) {
+            if (strcmp(argv[i], option) == 0) skip = true;
+        }
+        if (skip) {
+            ++i;
+            continue;
+        }
+        arguments.push_back(argv[i]);
+    }
+    return arguments;
+}
+
+std::vector<std::pair<std::string, std::string>> readManifest(const std::string &filename) {
+    std::ifstream file(filename);
+    if (!file) throw std::runtime_error("Couldn't open manifest \"" + filename + "\"");
+    std::vector<std::pair<std::string, std::string>> entries;
+    std::string line;
+    int line_number = 0;
+    while (std::getline(file, line)) {
+        ++line_number;
+        std::istringstream fields(line);
+        std::string input, output, extra;
+        if (!(fields >> input) || input[0] == '#') continue;
+        if (!(fields >> output) || (fields >> extra)) {
+            throw std::runtime_error("Manifest line " + std::to_string(line_number) +
+                                     " must be \"<input> <output>\"");
+        }
+        entries.emplace_back(input, output);
+    }
+    return entries;
+}
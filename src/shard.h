@@ -0,0 +1,75 @@
+#pragma once
+#include <ostream>
+#include <string>
+#include <sys/types.h>
+#include <utility>
+#include <vector>
+
+// Coordinator/worker mode for jobs too large for one process. The coordinator splits the
+// job into shards, each of them an ordinary imageTool run, and hands them to worker
+// processes over a Unix domain socket. Workers start one run per shard and report its exit
+// status, failed shards are retried on the next free worker.
+//
+// Protocol, one message per line: the worker sends READY, the coordinator answers with
+// SHARD <id>, one ARG <argument> line per argument and RUN, the worker replies with
+// DONE <id> <exit status> <seconds> and waits for the next shard or EXIT.
+
+struct Shard {
+    std::vector<std::string> arguments;
+    // Frames or manifest entries covered by the shard, for throughput
+    int items = 0;
+    std::string description;
+    // Where the worker writes its part of a split sequence, empty for manifest entries
+    std::string output_filename;
+    int attempts = 0;
+    bool done = false;
+};
+
+struct ShardWorkerStats {
+    pid_t pid = 0;
+    int shards = 0;
+    int items = 0;
+    int failures = 0;
+    double busy_seconds = 0;
+};
+
+class ShardCoordinator {
+  public:
+    static constexpr int MAX_ATTEMPTS = 3;
+
+    // Creates a private directory for the socket and the shard outputs
+    ShardCoordinator();
+    // Stops remaining workers and removes the directory with everything in it
+    ~ShardCoordinator();
+    ShardCoordinator(const ShardCoordinator &) = delete;
+    ShardCoordinator &operator=(const ShardCoordinator &) = delete;
+
+    const std::string &getDirectory() const noexcept { return directory; }
+    void addShard(Shard shard);
+    // Starts workers local worker processes and runs every shard. Throws std::runtime_error
+    // when a shard fails MAX_ATTEMPTS times or no worker is left.
+    void run(int workers, std::ostream &report);
+    // Concatenates the shard outputs in shard order
+    void mergeOutputs(const std::string &output_filename) const;
+    const std::vector<ShardWorkerStats> &getStats() const noexcept { return stats; }
+
+  private:
+    std::string directory;
+    std::string socket_path;
+    int listen_fd = -1;
+    std::vector<Shard> shards;
+    std::vector<ShardWorkerStats> stats;
+    std::vector<pid_t> worker_pids;
+};
+
+// Worker side: connects to the coordinator socket and runs shards until told to exit
+int runShardWorker(const std::string &socket_path);
+
+// Arguments of an imageTool run without the options that only concern the coordinator
+// (--workers, --manifest, --shard-frames) and without --input, --output and --frames,
+// which every shard sets itself
+std::vector<std::string> shardBaseArguments(int argc, char *argv[]);
+
+// Reads a manifest, one "<input> <output>" pair per line, blank lines and lines starting
+// with # are skipped
+std::vector<std::pair<std::string, std::string>> readManifest(const std::string &filename);
@@ -1,13 +1,24 @@
+#include "cache.h"
 #include "compare.h"
 #include "image.h"
 #include "upscaler.h"
+#include "upscaler_module.h"
+#include <algorithm>
+#include <atomic>
 #include <chrono>
 #include <cmath>
+#include <cstring>
 #include <iomanip>
 #include <iostream>
+#include <memory>
+#include <sstream>
 #include <string>
+#include <thread>
 #include <vector>
 
+// Taken during static initialization, as close to process start as portable code gets
+static const auto process_start = std::chrono::high_resolution_clock::now();
+
 struct UpscaleResult {
     std::string method_name;
     bool is_ai;
@@ -15,11 +26,16 @@ struct UpscaleResult {
     double psnr;
     double time_seconds;
     bool success;
+    bool cached;
+    // Images per second when upscaling a batch of copies, 0 when not measured
+    double batch_throughput;
     std::string error_message;
 };
 
-void printResults(const std::vector<UpscaleResult> &results) {
-    std::cout << "\nMethod\t\tType\t\tMSE\t\tPSNR\t\tTime(s)\t\tStatus" << std::endl;
+void printResults(const std::vector<UpscaleResult> &results, int batch_size) {
+    std::cout << "\nMethod\t\tType\t\tMSE\t\tPSNR\t\tTime(s)\t\t";
+    if (batch_size > 0) std::cout << "Batch(img/s)\t";
+    std::cout << "Status" << std::endl;
     std::cout << "-----------------------------------------------------------------------"
               << std::endl;
 
@@ -28,12 +44,147 @@ void printResults(const std::vector<UpscaleResult> &results) {
 
         if (result.success) {
             std::cout << std::fixed << std::setprecision(6) << result.mse << "\t\t" << result.psnr
-                      << "\t\t" << result.time_seconds << "\t\tOK";
+                      << "\t\t" << result.time_seconds << "\t\t";
+            if (batch_size > 0) {
+                if (result.batch_throughput > 0) {
+                    std::cout << std::setprecision(2) << result.batch_throughput << "\t\t";
+                } else {
+                    std::cout << "N/A\t\t";
+                }
+            }
+            std::cout << (result.cached ? "OK (cached)" : "OK");
         } else {
-            std::cout << "N/A\t\tN/A\t\tN/A\t\tFAILED: " << result.error_message;
+            std::cout << "N/A\t\tN/A\t\tN/A\t\t" << (batch_size > 0 ? "N/A\t\t" : "")
+                      << "FAILED: " << result.error_message;
+        }
+        std::cout << std::endl;
+    }
+}
+
+// One cell of the sweep matrix, a method at one downsample factor
+struct SweepCell {
+    bool success = false;
+    double mse = 0, psnr = 0, time_seconds = 0;
+    std::string error_message;
+};
+
+struct SweepRow {
+    std::string method_name;
+    bool is_ai = false;
+    bool created = false;
+    // Creating the upscaler, loading the model included; done once for all factors
+    double load_seconds = 0;
+    std::vector<SweepCell> cells;
+};
+
+// Method x factor matrix, every cell is MSE / PSNR / upscale time against the original.
+// threads is the number of methods that ran at once, their times include the contention.
+void printSweep(const std::vector<SweepRow> &rows, const std::vector<int> &factors,
+                int threads) {
+    std::cout << "\nMSE / PSNR (dB) / time (s) against the original" << std::endl;
+    if (threads > 1) {
+        std::cout << "Times measured with " << threads
+                  << " methods running concurrently, use --jobs 1 for uncontended times"
+                  << std::endl;
+    }
+    std::cout << std::endl;
+    std::cout << std::left << std::setw(10) << "Method" << std::setw(10) << "Load(s)";
+    for (int factor : factors) std::cout << std::setw(30) << "x" + std::to_string(factor);
+    std::cout << std::endl;
+
+    for (const SweepRow &row : rows) {
+        std::ostringstream load;
+        load << std::fixed << std::setprecision(3) << row.load_seconds;
+        std::cout << std::setw(10) << row.method_name << std::setw(10) << load.str();
+        for (const SweepCell &cell : row.cells) {
+            std::ostringstream text;
+            if (cell.success) {
+                text << std::fixed << std::setprecision(2) << cell.mse << " / " << cell.psnr
+                     << " / " << std::setprecision(3) << cell.time_seconds;
+            } else {
+                text << "FAILED";
+            }
+            std::cout << std::setw(30) << text.str();
         }
         std::cout << std::endl;
     }
+    std::cout << std::right;
+
+    for (const SweepRow &row : rows) {
+        // A failed upscaler creation fails every factor, its error is listed once
+        if (!row.created) {
+            std::cout << row.method_name << ": " << row.cells[0].error_message << std::endl;
+            continue;
+        }
+        for (size_t i = 0; i < row.cells.size(); ++i) {
+            if (row.cells[i].success) continue;
+            std::cout << row.method_name << " x" << factors[i] << ": "
+                      << row.cells[i].error_message << std::endl;
+        }
+    }
+}
+
+// Sweep mode: every downsample level is built once from the decoded original, each method
+// creates its upscaler once and runs the x2 model log2(factor) times per level. Methods run
+// concurrently on up to jobs threads; nothing is written to disk.
+std::vector<SweepRow> runSweep(const Image &original, const std::vector<int> &factors,
+                               const std::vector<std::pair<UpscaleMethod, std::string>> &methods,
+                               int jobs) {
+    std::vector<Image> levels(factors.size(), original);
+    for (size_t i = 0; i < factors.size(); ++i) {
+        levels[i].downSample(factors[i]);
+        std::cout << "Level x" << factors[i] << ": " << levels[i].getWidth() << "x"
+                  << levels[i].getHeight() << std::endl;
+    }
+
+    std::vector<SweepRow> rows(methods.size());
+    std::atomic<size_t> next(0);
+    auto worker = [&] {
+        for (size_t index = next++; index < methods.size(); index = next++) {
+            const auto &[method, model_path] = methods[index];
+            SweepRow &row = rows[index];
+            row.method_name = UpscalerFactory::methodToString(method);
+            row.is_ai = !model_path.empty();
+            row.cells.resize(factors.size());
+
+            std::unique_ptr<BaseUpscaler> upscaler;
+            try {
+                auto start = std::chrono::high_resolution_clock::now();
+                upscaler = UpscalerFactory::createUpscaler(method, model_path);
+                row.load_seconds = std::chrono::duration<double>(
+                                       std::chrono::high_resolution_clock::now() - start)
+                                       .count();
+                row.created = true;
+            } catch (const std::exception &e) {
+                for (SweepCell &cell : row.cells) cell.error_message = e.what();
+                continue;
+            }
+
+            for (size_t i = 0; i < factors.size(); ++i) {
+                SweepCell &cell = row.cells[i];
+                try {
+                    Image image = levels[i];
+                    int passes = static_cast<int>(std::log2(factors[i]));
+                    auto start = std::chrono::high_resolution_clock::now();
+                    for (int pass = 0; pass < passes; ++pass) upscaler->upscale(image, 2);
+                    cell.time_seconds = std::chrono::duration<double>(
+                                            std::chrono::high_resolution_clock::now() - start)
+                                            .count();
+                    cell.mse = MSE(original, image, true);
+                    cell.psnr = psnr(cell.mse, 255);
+                    cell.success = true;
+                } catch (const std::exception &e) {
+                    cell.error_message = e.what();
+                }
+            }
+        }
+    };
+
+    std::vector<std::thread> threads;
+    int count = std::min<int>(std::max(jobs, 1), methods.size());
+    for (int i = 0; i < count; ++i) threads.emplace_back(worker);
+    for (std::thread &thread : threads) thread.join();
+    return rows;
 }
 
 void iterativeUpscale(Image &image, UpscaleMethod method, int total_factor,
@@ -45,20 +196,82 @@ void iterativeUpscale(Image &image, UpscaleMethod method, int total_factor,
     }
 }
 
+// Batch variant, every pass upscales all images with one upscaler call
+void iterativeUpscale(std::vector<Image> &images, UpscaleMethod method, int total_factor,
+                      const std::string &model_path = "") {
+    int p = static_cast<int>(std::log2(total_factor));
+    for (int i = 0; i < p; i++) {
+        auto upscaler = UpscalerFactory::createUpscaler(method, model_path);
+        upscaler->upscale(images, 2);
+    }
+}
+
 int main(int argc, char *argv[]) {
-    if (argc < 4) {
+    // Cache options may appear anywhere, the rest of the arguments are positional
+    std::vector<std::string> args;
+    std::string cache_dir = ResultCache::directoryFromEnvironment();
+    bool no_cache = false;
+    int batch_size = 0;
+    // Sweep mode, --sweep <factors> [--methods <names>] [--jobs <threads>]
+    std::vector<int> sweep_factors;
+    std::vector<std::string> sweep_methods;
+    int jobs = std::max(1u, std::thread::hardware_concurrency());
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--no-cache") == 0) {
+            no_cache = true;
+        } else if (strcmp(argv[i], "--batch") == 0 && i + 1 < argc) {
+            batch_size = std::atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--sweep") == 0 && i + 1 < argc) {
+            std::stringstream list(argv[++i]);
+            std::string factor;
+            while (std::getline(list, factor, ',')) {
+                sweep_factors.push_back(std::atoi(factor.c_str()));
+            }
+        } else if (strcmp(argv[i], "--methods") == 0 && i + 1 < argc) {
+            std::stringstream list(argv[++i]);
+            std::string method;
+            while (std::getline(list, method, ',')) sweep_methods.push_back(method);
+        } else if (strcmp(argv[i], "--jobs") == 0 && i + 1 < argc) {
+            jobs = std::atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--cache-dir") == 0 && i + 1 < argc) {
+            cache_dir = argv[++i];
+        } else {
+            args.push_back(argv[i]);
+        }
+    }
+
+    bool sweep = !sweep_factors.empty();
+    if (args.size() < (sweep ? 2u : 3u)) {
         std::cout << "Usage: " << argv[0]
-                  << " <input_file> <input_format> <scale_factor> [model_directory]" << std::endl;
+                  << " <input_file> <input_format> <scale_factor> [model_directory]"
+                     " [--cache-dir <dir>] [--no-cache] [--batch <images>]\n       "
+                  << argv[0]
+                  << " <input_file> <input_format> [model_directory] --sweep <factors>"
+                     " [--methods <names>] [--jobs <threads>]"
+                  << std::endl;
         return 1;
     }
 
-    std::string input_filename = argv[1];
-    std::string input_format_name = argv[2];
-    int scale_factor = std::atoi(argv[3]);
-    std::string model_dir = (argc > 4) ? argv[4] : "./models/";
+    std::string input_filename = args[0];
+    std::string input_format_name = args[1];
+    // Sweep mode takes the factors from --sweep, the model directory moves up
+    size_t model_dir_arg = sweep ? 2 : 3;
+    int scale_factor = sweep ? 0 : std::atoi(args[2].c_str());
+    std::string model_dir = (args.size() > model_dir_arg) ? args[model_dir_arg] : "./models/";
 
-    if (scale_factor <= 0 || (scale_factor & (scale_factor - 1)) != 0) {
-        std::cerr << "Scale factor must be a power of 2" << std::endl;
+    std::vector<int> factors = sweep ? sweep_factors : std::vector<int>{scale_factor};
+    for (int factor : factors) {
+        if (factor <= 0 || (factor & (factor - 1)) != 0) {
+            std::cerr << "Scale factor must be a power of 2" << std::endl;
+            return 1;
+        }
+    }
+    if (sweep && batch_size > 0) {
+        std::cerr << "--batch can't be combined with --sweep" << std::endl;
+        return 1;
+    }
+    if (jobs <= 0) {
+        std::cerr << "--jobs must be a positive integer" << std::endl;
         return 1;
     }
 
@@ -75,97 +288,166 @@ int main(int argc, char *argv[]) {
         input_format = ImageFormat::YUV422P;
     } else if (input_format_name == "YUV444P") {
         input_format = ImageFormat::YUV444P;
+    } else if (input_format_name == "Y4M") {
+        input_format = ImageFormat::Y4M;
     } else {
         std::cerr << "Invalid input format" << std::endl;
         return 1;
     }
 
     Image original_image;
+    double startup_seconds = 0;
     try {
         original_image.loadImageFromFile(input_filename, input_format);
         std::cout << "Loaded image: " << original_image.getWidth() << "x"
                   << original_image.getHeight() << std::endl;
+        // Everything up to here is what a plain conversion pays before its first pixel
+        startup_seconds = std::chrono::duration<double>(
+                              std::chrono::high_resolution_clock::now() - process_start)
+                              .count();
     } catch (const std::exception &e) {
         std::cerr << "Error loading image: " << e.what() << std::endl;
         return 1;
     }
 
-    Image downsampled = original_image;
-    downsampled.downSample(scale_factor);
-    std::cout << "Downsampled to: " << downsampled.getWidth() << "x" << downsampled.getHeight()
-              << std::endl;
-
-    std::vector<UpscaleResult> results;
-
     std::vector<UpscaleMethod> traditional_methods = {UpscaleMethod::BICUBIC,
                                                       UpscaleMethod::LANCZOS, UpscaleMethod::BTVL1};
+    std::vector<std::pair<UpscaleMethod, std::string>> ai_methods = {
+        {UpscaleMethod::ESPCN, "ESPCN_x2.pb"},
+        {UpscaleMethod::FSRCNN, "FSRCNN_x2.pb"},
+        {UpscaleMethod::EDSR, "EDSR_x2.pb"},
+        {UpscaleMethod::LAPSRN, "LapSRN_x2.pb"}};
 
-    for (auto method : traditional_methods) {
-        UpscaleResult result;
-        result.method_name = UpscalerFactory::methodToString(method);
-        result.is_ai = false;
-
-        try {
-            Image test_image = downsampled;
-
-            auto start = std::chrono::high_resolution_clock::now();
-            iterativeUpscale(test_image, method, scale_factor);
-            auto end = std::chrono::high_resolution_clock::now();
+    if (sweep) {
+        // Methods with their model path, empty for the traditional ones
+        std::vector<std::pair<UpscaleMethod, std::string>> methods;
+        for (UpscaleMethod method : traditional_methods) methods.push_back({method, ""});
+        for (auto &[method, model_file] : ai_methods) {
+            methods.push_back({method, model_dir + model_file});
+        }
+        if (!sweep_methods.empty()) {
+            std::vector<std::pair<UpscaleMethod, std::string>> selected;
+            for (const std::string &name : sweep_methods) {
+                UpscaleMethod method;
+                try {
+                    method = UpscalerFactory::stringToMethod(name);
+                } catch (const std::exception &e) {
+                    std::cerr << e.what() << std::endl;
+                    return 1;
+                }
+                for (const auto &entry : methods) {
+                    if (entry.first == method) selected.push_back(entry);
+                }
+            }
+            methods = selected;
+        }
 
-            result.time_seconds = std::chrono::duration<double>(end - start).count();
-            result.mse = MSE(original_image, test_image, true);
-            result.psnr = psnr(result.mse, 255);
-            result.success = true;
+        auto start = std::chrono::high_resolution_clock::now();
+        int threads = std::min<int>(jobs, methods.size());
+        std::vector<SweepRow> rows = runSweep(original_image, factors, methods, jobs);
+        printSweep(rows, factors, threads);
+        std::cout << "\nSweep of " << methods.size() << " methods x " << factors.size()
+                  << " factors on " << threads
+                  << " threads: " << std::fixed << std::setprecision(2)
+                  << std::chrono::duration<double>(std::chrono::high_resolution_clock::now() -
+                                                   start)
+                         .count()
+                  << " s" << std::endl;
+        std::cout << "Startup without the upscaler module (input decoded): "
+                  << std::setprecision(2) << startup_seconds * 1000 << " ms" << std::endl;
+        std::cout << "Upscaler module load time: " << std::setprecision(2)
+                  << upscalerModuleLoadSeconds() * 1000 << " ms" << std::endl;
+        return 0;
+    }
 
-            std::string output_filename = "output/output_" + result.method_name + ".bmp";
-            test_image.saveImageToFile(output_filename, ImageFormat::BMP);
-            std::cout << "Saved: " << output_filename << std::endl;
+    Image downsampled = original_image;
+    downsampled.downSample(scale_factor);
+    std::cout << "Downsampled to: " << downsampled.getWidth() << "x" << downsampled.getHeight()
+              << std::endl;
 
+    std::unique_ptr<ResultCache> cache;
+    std::string input_hash;
+    if (!cache_dir.empty()) {
+        try {
+            cache = std::make_unique<ResultCache>(cache_dir);
+            input_hash = hashToHex(hashFile(input_filename));
         } catch (const std::exception &e) {
-            result.success = false;
-            result.error_message = e.what();
+            std::cerr << "Warning: result cache disabled: " << e.what() << std::endl;
+            cache.reset();
         }
-
-        results.push_back(result);
     }
 
-    std::vector<std::pair<UpscaleMethod, std::string>> ai_methods = {
-        {UpscaleMethod::ESPCN, "ESPCN_x2.pb"},
-        {UpscaleMethod::FSRCNN, "FSRCNN_x2.pb"},
-        {UpscaleMethod::EDSR, "EDSR_x2.pb"},
-        {UpscaleMethod::LAPSRN, "LapSRN_x2.pb"}};
-
-    for (auto &[method, model_file] : ai_methods) {
+    auto runMethod = [&](UpscaleMethod method, bool is_ai, const std::string &model_path) {
         UpscaleResult result;
         result.method_name = UpscalerFactory::methodToString(method);
-        result.is_ai = true;
+        result.is_ai = is_ai;
+        result.cached = false;
+        result.batch_throughput = 0;
 
         try {
             Image test_image = downsampled;
-            std::string model_path = model_dir + model_file;
+            std::string output_filename = "output/output_" + result.method_name + ".bmp";
+            std::string cache_key;
+            if (cache) {
+                cache_key = "tool=upscale_comparison input=" + input_hash +
+                            " input_format=" + input_format_name +
+                            " scale=" + std::to_string(scale_factor) +
+                            " method=" + result.method_name + " model=" +
+                            (model_path.empty() ? "none" : hashToHex(hashFile(model_path)));
+            }
 
-            auto start = std::chrono::high_resolution_clock::now();
-            iterativeUpscale(test_image, method, scale_factor, model_path);
-            auto end = std::chrono::high_resolution_clock::now();
+            if (cache && !no_cache && cache->fetch(cache_key, output_filename)) {
+                test_image.loadImageFromFile(output_filename, ImageFormat::BMP);
+                result.time_seconds = 0;
+                result.cached = true;
+            } else {
+                auto start = std::chrono::high_resolution_clock::now();
+                iterativeUpscale(test_image, method, scale_factor, model_path);
+                auto end = std::chrono::high_resolution_clock::now();
+                result.time_seconds = std::chrono::duration<double>(end - start).count();
+
+                test_image.saveImageToFile(output_filename, ImageFormat::BMP);
+                if (cache) cache->store(cache_key, output_filename);
+            }
+
+            // Throughput of batch_size copies, the cache doesn't apply to this measurement
+            if (batch_size > 0) {
+                std::vector<Image> batch(batch_size, downsampled);
+                auto start = std::chrono::high_resolution_clock::now();
+                iterativeUpscale(batch, method, scale_factor, model_path);
+                auto end = std::chrono::high_resolution_clock::now();
+                result.batch_throughput =
+                    batch_size / std::chrono::duration<double>(end - start).count();
+            }
 
-            result.time_seconds = std::chrono::duration<double>(end - start).count();
             result.mse = MSE(original_image, test_image, true);
             result.psnr = psnr(result.mse, 255);
             result.success = true;
-
-            std::string output_filename = "output/output_" + result.method_name + ".bmp";
-            test_image.saveImageToFile(output_filename, ImageFormat::BMP);
-            std::cout << "Saved: " << output_filename << std::endl;
+            std::cout << (result.cached ? "Cached: " : "Saved: ") << output_filename << std::endl;
 
         } catch (const std::exception &e) {
             result.success = false;
             result.error_message = e.what();
         }
 
-        results.push_back(result);
+        return result;
+    };
+
+    std::vector<UpscaleResult> results;
+
+    for (auto method : traditional_methods) {
+        results.push_back(runMethod(method, false, ""));
+    }
+
+    for (auto &[method, model_file] : ai_methods) {
+        results.push_back(runMethod(method, true, model_dir + model_file));
     }
 
-    printResults(results);
+    printResults(results, batch_size);
+    std::cout << "\nStartup without the upscaler module (input decoded): " << std::setprecision(2)
+              << startup_seconds * 1000 << " ms" << std::endl;
+    std::cout << "Upscaler module load time: " << std::setprecision(2)
+              << upscalerModuleLoadSeconds() * 1000 << " ms" << std::endl;
     std::cout << "\nComparison complete!" << std::endl;
 
     return 0;
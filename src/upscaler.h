@@ -1,13 +1,10 @@
 #pragma once
+#include "dnn_tuning.h"
 #include "image.h"
 #include <memory>
 #include <string>
 #include <vector>
 
-#include <opencv2/dnn_superres.hpp>
-#include <opencv2/opencv.hpp>
-#include <opencv2/superres.hpp>
-
 enum class UpscaleMethod {
     // Non-AI methods
     BICUBIC,
@@ -25,55 +22,35 @@ class BaseUpscaler {
   public:
     virtual ~BaseUpscaler() = default;
     virtual void upscale(Image &image, int scale_factor) = 0;
+    // Upscales every image of the batch, implementations may process several at once
+    virtual void upscale(std::vector<Image> &images, int scale_factor) {
+        for (Image &image : images) upscale(image, scale_factor);
+    }
     virtual std::string getName() const = 0;
     virtual bool isAI() const = 0;
+    // Execution settings of DNN based upscalers, ignored by the others
+    virtual void setConfig(const DnnConfig &) {}
+    // Working memory in bytes for upscaling one width x height image, not counting the input
+    // and the upscaled image themselves. Memory owned by OpenCV is a per-pixel estimate.
+    virtual size_t estimateMemory(int width, int height, int scale_factor) const = 0;
+    // Temporal upscalers use the following frames of a sequence: every frame is passed to
+    // addFrame, after preparation, getLookahead() frames before it goes through upscale, and
+    // frames are upscaled in order. Single images are upscaled on their own.
+    virtual int getLookahead() const { return 0; }
+    virtual void addFrame(const Image &) {}
 };
 
-class TraditionalUpscaler : public BaseUpscaler {
-  private:
-    UpscaleMethod method;
-    cv::Ptr<cv::superres::SuperResolution> sr_processor;
-
-  public:
-    explicit TraditionalUpscaler(UpscaleMethod method);
-    ~TraditionalUpscaler() override = default;
-
-    void upscale(Image &image, int scale_factor) override;
-    std::string getName() const override;
-    bool isAI() const override { return false; }
-
-  private:
-    cv::Mat imageToMat(const Image &image);
-    void matToImage(const cv::Mat &mat, Image &image);
-};
-
-class AIUpscaler : public BaseUpscaler {
-  private:
-    UpscaleMethod method;
-    cv::dnn_superres::DnnSuperResImpl sr;
-    bool model_loaded;
-    std::string model_path;
-
-  public:
-    explicit AIUpscaler(UpscaleMethod method, const std::string &model_path = "");
-    ~AIUpscaler() override = default;
-
-    void upscale(Image &image, int scale_factor) override;
-    std::string getName() const override;
-    bool isAI() const override { return true; }
-    bool loadModel(const std::string &path);
-
-  private:
-    cv::Mat imageToMat(const Image &image);
-    void matToImage(const cv::Mat &mat, Image &image);
-    std::string getModelName() const;
-};
-
+// The upscalers live in a separately built module that links OpenCV, so runs without
+// --upscale-method never load it. createUpscaler loads the module on first use.
 class UpscalerFactory {
   public:
     static std::unique_ptr<BaseUpscaler> createUpscaler(UpscaleMethod method,
                                                         const std::string &model_path = "");
     static std::vector<UpscaleMethod> getAvailableMethods();
+    static bool isAIMethod(UpscaleMethod method);
+    // Whether the model's receptive field fits in the halo of concurrently upscaled bands, so
+    // that DnnConfig::tile_workers can't change the output. Other models aren't split.
+    static bool supportsBands(UpscaleMethod method);
     static std::string methodToString(UpscaleMethod method);
     static UpscaleMethod stringToMethod(const std::string &method_name);
 };
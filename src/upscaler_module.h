@@ -0,0 +1,22 @@
+#pragma once
+#include "upscaler.h"
+#include <string>
+
+// Interface between the core and the OpenCV upscaler module (opencv_upscalers.cpp), which is
+// built as a shared library and loaded with dlopen. The version changes with every change to
+// the layout of this table, the BaseUpscaler vtable or Image, so a stale module is refused.
+constexpr int UPSCALER_MODULE_VERSION = 4;
+constexpr const char *UPSCALER_MODULE_FILE = "libimagetool_upscalers.so";
+constexpr const char *UPSCALER_MODULE_SYMBOL = "imageToolUpscalerModule";
+
+struct UpscalerModule {
+    int version;
+    // Heap allocated upscaler, throws like the upscaler constructors
+    BaseUpscaler *(*create_upscaler)(UpscaleMethod method, const std::string &model_path);
+    bool (*half_precision_supported)();
+};
+
+// Loads the module on first use, throws std::runtime_error if it can't be loaded
+const UpscalerModule &upscalerModule();
+// Time spent loading the module, 0 until it has been loaded
+double upscalerModuleLoadSeconds();
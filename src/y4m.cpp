@@ -0,0 +1,124 @@
+#include "y4m.h"
+
+#include <sstream>
+#include <stdexcept>
+
+static constexpr size_t MAX_HEADER_LENGTH = 1024;
+
+static bool readLine(FILE *file, std::string &line) {
+    line.clear();
+    int c;
+    while ((c = fgetc(file)) != EOF && c != '\n') {
+        if (line.size() >= MAX_HEADER_LENGTH) {
+            throw std::runtime_error("Y4M header line is too long");
+        }
+        line.push_back(static_cast<char>(c));
+    }
+    if (c == EOF && line.empty()) return false;
+    if (c == EOF) throw std::runtime_error("Unexpected end of Y4M stream");
+    return true;
+}
+
+static ImageFormat parseChroma(const std::string &tag) {
+    if (tag == "420" || tag == "420jpeg" || tag == "420paldv" || tag == "420mpeg2") {
+        return ImageFormat::YUV420P;
+    } else if (tag == "422") {
+        return ImageFormat::YUV422P;
+    } else if (tag == "444") {
+        return ImageFormat::YUV444P;
+    }
+    throw std::runtime_error("Unsupported Y4M chroma subsampling: C" + tag);
+}
+
+static std::string chromaTag(ImageFormat chroma) {
+    switch (chroma) {
+    case ImageFormat::YUV420P:
+        return "420jpeg";
+    case ImageFormat::YUV422P:
+        return "422";
+    case ImageFormat::YUV444P:
+        return "444";
+    default:
+        throw std::invalid_argument("Y4M supports only planar 4:2:0, 4:2:2 and 4:4:4 chroma");
+    }
+}
+
+Y4MReader::Y4MReader(FILE *file) : file(file) {
+    if (!file) {
+        throw std::runtime_error("Invalid file handle");
+    }
+    std::string line;
+    if (!readLine(file, line)) {
+        throw std::runtime_error("Empty Y4M stream");
+    }
+    std::istringstream tags(line);
+    std::string tag;
+    if (!(tags >> tag) || tag != "YUV4MPEG2") {
+        throw std::runtime_error("Invalid Y4M signature");
+    }
+    while (tags >> tag) {
+        std::string value = tag.substr(1);
+        switch (tag[0]) {
+        case 'W':
+            header.width = std::stoi(value);
+            break;
+        case 'H':
+            header.height = std::stoi(value);
+            break;
+        case 'C':
+            header.chroma = parseChroma(value);
+            break;
+        case 'F':
+            header.frame_rate = value;
+            break;
+        case 'I':
+            header.interlacing = value;
+            break;
+        case 'A':
+            header.aspect = value;
+            break;
+        default:
+            break;
+        }
+    }
+    if (header.width <= 0 || header.height <= 0) {
+        throw std::runtime_error("Y4M header has no valid frame size");
+    }
+}
+
+const Y4MHeader &Y4MReader::getHeader() const noexcept { return header; }
+
+bool Y4MReader::readFrame(Image &image) {
+    std::string line;
+    if (!readLine(file, line)) return false;
+    if (line.compare(0, 5, "FRAME") != 0) {
+        throw std::runtime_error("Invalid Y4M frame header");
+    }
+    image = Image(header.width, header.height, image.getLayout());
+    image.loadImage(file, header.chroma);
+    return true;
+}
+
+Y4MWriter::Y4MWriter(FILE *file, const Y4MHeader &header)
+    : file(file), header(header), header_written(false) {
+    chromaTag(header.chroma);
+}
+
+void Y4MWriter::writeFrame(const Image &image) {
+    if (!header_written) {
+        header.width = image.getWidth();
+        header.height = image.getHeight();
+        if (fprintf(file, "YUV4MPEG2 W%d H%d F%s I%s A%s C%s\n", header.width, header.height,
+                    header.frame_rate.c_str(), header.interlacing.c_str(), header.aspect.c_str(),
+                    chromaTag(header.chroma).c_str()) < 0) {
+            throw std::runtime_error("Couldn't write to file");
+        }
+        header_written = true;
+    } else if (image.getWidth() != header.width || image.getHeight() != header.height) {
+        throw std::runtime_error("All frames of a Y4M stream must have the same size");
+    }
+    if (fputs("FRAME\n", file) < 0) {
+        throw std::runtime_error("Couldn't write to file");
+    }
+    image.saveImage(file, header.chroma);
+}
@@ -0,0 +1,41 @@
+#pragma once
+#include "image.h"
+#include <cstdio>
+#include <string>
+
+// Stream parameters of a YUV4MPEG2 file, only 8-bit 4:2:0/4:2:2/4:4:4 are supported
+struct Y4MHeader {
+    int width = 0;
+    int height = 0;
+    ImageFormat chroma = ImageFormat::YUV420P;
+    std::string frame_rate = "25:1";
+    std::string interlacing = "p";
+    std::string aspect = "1:1";
+};
+
+// Reads a Y4M stream one FRAME at a time, only a single frame is kept in memory
+class Y4MReader {
+  public:
+    explicit Y4MReader(FILE *file);
+
+    const Y4MHeader &getHeader() const noexcept;
+    // Returns false when the end of the stream is reached
+    bool readFrame(Image &image);
+
+  private:
+    FILE *file;
+    Y4MHeader header;
+};
+
+// Writes a Y4M stream, the stream header is emitted together with the first frame
+class Y4MWriter {
+  public:
+    explicit Y4MWriter(FILE *file, const Y4MHeader &header = Y4MHeader());
+
+    void writeFrame(const Image &image);
+
+  private:
+    FILE *file;
+    Y4MHeader header;
+    bool header_written;
+};